@@ -1,51 +1,152 @@
-#include "quality_measures.h"
-#include <timing.h>
-#include <Halide.h>
-#include <image_io.h>
-#include <iostream>
-#include <vector>
-
-using namespace Halide;
-
-int main(int argc, char** argv)
-{
-    Buffer<float> parrot = load<float>("images/parrot.png");
-
-    // Test the intermediate debug outputs.
-    Buffer<float> grayscale = Measures::compute(parrot, 1.f, 1.f, 1.f, Measures::DebugIntermediate::Grayscale);
-    save(grayscale, "Output/grayscale.png");
-
-    Buffer<float> laplacian = Measures::compute(parrot, 1.f, 1.f, 1.f, Measures::DebugIntermediate::Laplacian);
-    save(laplacian, "Output/laplacian.png");
-
-    Buffer<float> contrast = Measures::compute(parrot, 1.f, 1.f, 1.f, Measures::DebugIntermediate::Contrast);
-    save(contrast, "Output/contrast.png");
-
-    Buffer<float> saturation = Measures::compute(parrot, 1.f, 1.f, 1.f, Measures::DebugIntermediate::Saturation);
-    save(saturation, "Output/saturation.png");
-
-    Buffer<float> exposure = Measures::compute(parrot, 1.f, 1.f, 1.f, Measures::DebugIntermediate::Exposure);
-    save(exposure, "Output/exposure.png");
-
-    Buffer<float> weight = Measures::compute(parrot, 1.f, 1.f, 1.f, Measures::DebugIntermediate::Weight);
-
-    save(weight, "Output/weight.png");
-
-    // Test the fusion.
-    
-    std::vector<Buffer<float>> in;
-    in.push_back(load<float>("images/house-1.png"));
-    in.push_back(load<float>("images/house-2.png"));
-    in.push_back(load<float>("images/house-3.png"));
-    in.push_back(load<float>("images/house-4.png"));
-
-    std::vector<Buffer<float>> weight_maps;
-    for (size_t i = 0; i < in.size(); i++) {
-        weight_maps.push_back(Measures::compute(in[i]));
-    }
-
-    Buffer<float> fusion = Measures::compute_fusion(in, weight_maps);
-    save(fusion, "Output/fusion.png");
-
-    return EXIT_SUCCESS;
-}
+#include "quality_measures.h"
+#include "pyramid.h"
+#include "progressive_fusion.h"
+#include <timing.h>
+#include <image_io.h>
+#include <iostream>
+#include <map>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    Buffer<float> parrot = load<float>("images/parrot.png");
+
+    // Test the intermediate debug outputs, all computed in one pass.
+    std::map<Measures::DebugIntermediate, Buffer<float>> intermediates = Measures::compute_intermediates(parrot, {
+        Measures::DebugIntermediate::Grayscale,
+        Measures::DebugIntermediate::Laplacian,
+        Measures::DebugIntermediate::Contrast,
+        Measures::DebugIntermediate::Saturation,
+        Measures::DebugIntermediate::Exposure,
+        Measures::DebugIntermediate::Weight
+    });
+    save(intermediates[Measures::DebugIntermediate::Grayscale], "Output/grayscale.png");
+    save(intermediates[Measures::DebugIntermediate::Laplacian], "Output/laplacian.png");
+    save(intermediates[Measures::DebugIntermediate::Contrast], "Output/contrast.png");
+    save(intermediates[Measures::DebugIntermediate::Saturation], "Output/saturation.png");
+    save(intermediates[Measures::DebugIntermediate::Exposure], "Output/exposure.png");
+    save(intermediates[Measures::DebugIntermediate::Weight], "Output/weight.png");
+
+    // Compare the weight schedules.
+    for (Measures::Schedule schedule : {Measures::Schedule::Root, Measures::Schedule::Tiled}) {
+        ProfileStats stats = profile_callable([&]() {
+            Measures::compute(parrot, 1.f, 1.f, 1.f, Measures::DebugIntermediate::None, schedule);
+        });
+
+        std::cout << (schedule == Measures::Schedule::Root ? "Root schedule:" : "Tiled schedule:");
+        print_profile(stats, float(parrot.width() * parrot.height()) / 1e6);
+    }
+
+    // Test the fusion.
+    
+    std::vector<std::string> house = {"images/house-1.png", "images/house-2.png", "images/house-3.png", "images/house-4.png"};
+    std::vector<double> decode_ms;
+    std::vector<Buffer<float>> in = load_bracket<float>(house, &decode_ms);
+    for (size_t i = 0; i < house.size(); i++) {
+        std::cout << "Decoded " << house[i] << " in " << decode_ms[i] << " ms" << std::endl;
+    }
+
+    // The weight maps of all the exposures, normalized.
+    Buffer<float> weight_maps = Measures::compute_bracket(in);
+
+    Buffer<float> fusion = Measures::compute_fusion(in, weight_maps);
+    save(fusion, "Output/fusion.png");
+
+    // Test the multi-scale blend.
+    Buffer<float> pyramid_fusion = Measures::compute_pyramid_fusion(in, weight_maps);
+    save(pyramid_fusion, "Output/pyramid-fusion.png");
+
+    // The progressive fusion: a coarse preview within a few milliseconds,
+    // then refined to full resolution from where it stopped.
+    {
+        Measures::ProgressiveFusion progressive(in);
+        uint64_t start = nanosecond_timer();
+        Buffer<float> preview = progressive.refine(20.0);
+        double preview_ms = (nanosecond_timer() - start) / 1e6;
+        save(preview, "Output/progressive-preview.png");
+
+        start = nanosecond_timer();
+        Buffer<float> refined = progressive.refine();
+        double refine_ms = (nanosecond_timer() - start) / 1e6;
+        save(refined, "Output/progressive-fusion.png");
+
+        Measures::StorageError error = Measures::storage_error(refined, pyramid_fusion);
+        std::cout << "Progressive fusion: " << preview.width() << "x" << preview.height() << " preview in "
+            << preview_ms << " ms, refined in " << refine_ms << " ms, PSNR " << error.psnr
+            << " dB against the pyramid fusion" << std::endl;
+    }
+
+    // The frame accumulator, whose memory stays the same from the first
+    // frame on, against the pyramid fusion.
+    {
+        Pyramid::LevelPool pool;
+        Measures::FusionAccumulator accumulator(1.f, 1.f, 1.f, Measures::Math::Exact, 0, &pool);
+        std::vector<size_t> held;
+        for (const Buffer<float> &frame : in) {
+            accumulator.add_frame(frame);
+            held.push_back(pool.stats().bytes);
+        }
+        Buffer<float> accumulated = accumulator.finish();
+        save(accumulated, "Output/accumulated-fusion.png");
+
+        Measures::StorageError error = Measures::storage_error(accumulated, pyramid_fusion);
+        std::cout << "Accumulated fusion: " << held.back() / (1024.f * 1024.f) << " MB of levels for "
+            << in.size() << " frames, PSNR " << error.psnr << " dB against the pyramid fusion" << std::endl;
+    }
+
+    // Report the level allocations of two blends with and without reuse.
+    for (bool reuse : {false, true}) {
+        Pyramid::LevelPool pool(reuse);
+        for (int i = 0; i < 2; i++) {
+            Pyramid::blend(in, weight_maps, 0, &pool);
+        }
+        Pyramid::LevelPool::Stats stats = pool.stats();
+        std::cout << (reuse ? "Pooled" : "Unpooled") << " pyramid levels:"
+            << " " << stats.allocations << " allocations,"
+            << " peak " << stats.peak_bytes / (1024.f * 1024.f) << " MB" << std::endl;
+    }
+
+    // Report where the time of the weight, fusion and pyramid pipelines goes.
+    {
+        Measures::Report reports[3];
+        Measures::compute(in[0], 1.f, 1.f, 1.f, Measures::DebugIntermediate::None,
+                          Measures::Schedule::Tiled, Measures::Math::Exact, &reports[0]);
+        Measures::compute_fusion(in, weight_maps, &reports[1]);
+        Measures::compute_pyramid_fusion(in, weight_maps, 0, &reports[2]);
+
+        for (const Measures::Report &report : reports) {
+            std::cout << report.pipeline << ": " << report.time_ms << " ms,"
+                << " peak " << report.peak_bytes / (1024.f * 1024.f) << " MB" << std::endl;
+            for (const Measures::StageReport &stage : report.stages) {
+                std::cout << "  " << stage.name << " " << stage.time_ms << " ms (" << stage.percentage << "%),"
+                    << " peak " << stage.peak_bytes / (1024.f * 1024.f) << " MB,"
+                    << " " << stage.threads << " threads" << std::endl;
+            }
+        }
+    }
+
+    // Fuse the JPEG copy of the house bracket decoded at a quarter of its
+    // resolution, without decoding the full-resolution pixels.
+    {
+        std::vector<Buffer<float>> preview;
+        for (int i = 1; i <= 4; i++) {
+            preview.push_back(load_jpeg<float>("images/house-" + std::to_string(i) + ".jpg", 4));
+        }
+        Buffer<float> preview_fusion = Measures::compute_fusion(preview, Measures::compute_bracket(preview));
+        save(preview_fusion, "Output/fusion-preview.png");
+        std::cout << "Preview fusion of the JPEG bracket: " << preview_fusion.width() << "x"
+            << preview_fusion.height() << std::endl;
+    }
+
+    // Fuse the 8-bit samples of the bracket, normalized inside the pipelines.
+    {
+        std::vector<Buffer<uint8_t>> in_u8 = load_bracket<uint8_t>(house);
+        std::vector<Buffer<float>> weights_u8;
+        for (const Buffer<uint8_t> &frame : in_u8) {
+            weights_u8.push_back(Measures::compute(frame));
+        }
+        save(Measures::compute_fusion(in_u8, weights_u8), "Output/fusion-u8.png");
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+// Fuses many bracket sets, listed in a manifest or found in a directory, in
+// a three-stage pipeline:
+//
+//   decode threads -> compute (this thread, Halide's thread pool) -> encode threads
+//
+// The stages are connected by bounded queues, so the files of the next sets
+// are decoded and the results of the previous sets encoded while a set is
+// being fused, and at most a few sets are held in memory at once.
+//
+// A manifest has one set per line: the name of the output, then the files of
+// its exposures. Blank lines and lines starting with # are skipped (see
+// images/brackets.txt). A directory holds one subdirectory per set, whose
+// png, jpg, ppm and pfm files are the exposures in name order. Each set is saved
+// as <output dir>/<name>.png.
+//
+// A set whose exposures can't be read, or differ in size, or whose result
+// can't be written is reported and skipped; the others are still fused. The
+// exit status is nonzero if any set failed.
+//
+// Usage: batch [options] <manifest | directory> <output dir>
+//   --decode-threads N  sets decoded concurrently (2)
+//   --encode-threads N  results encoded concurrently (2)
+//   --queue N           sets waiting in each queue (2)
+//   --pyramid           blend in a Laplacian pyramid instead of per pixel
+//   --png-level N       zlib level of the outputs, 0 to 9 (6)
+//   --png-threads N     threads deflating each output, 0 for one per core (1)
+
+#include "quality_measures.h"
+#include <timing.h>
+#include <image_io.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BracketSet {
+    std::string name;
+    std::vector<std::string> files;
+};
+
+// A set on its way through the pipeline.
+struct Job {
+    size_t index;
+    std::vector<Buffer<float>> frames;
+    Buffer<float> fusion;
+    double decode_ms = 0.0;
+    double compute_ms = 0.0;
+    // Why the set failed, empty if it didn't.
+    std::string error;
+};
+
+// A FIFO that blocks producers while it holds capacity items and consumers
+// while it is empty. Once closed, pop() drains what is left and then fails.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [&]() { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [&]() { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex lock;
+    std::condition_variable not_full, not_empty;
+};
+
+static bool is_image(const std::filesystem::path &path) {
+    std::string name = path.filename().string();
+    return ends_with_ignore_case(name, ".png") || ends_with_ignore_case(name, ".jpg") ||
+           ends_with_ignore_case(name, ".jpeg") || ends_with_ignore_case(name, ".ppm") ||
+           ends_with_ignore_case(name, ".pfm");
+}
+
+static std::vector<BracketSet> read_manifest(const std::string &filename) {
+    std::ifstream manifest(filename);
+    _assert(manifest.is_open(), "[batch] could not open %s\n", filename.c_str());
+
+    std::vector<BracketSet> sets;
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream fields(line);
+        BracketSet set;
+        if (!(fields >> set.name) || set.name[0] == '#') {
+            continue;
+        }
+        for (std::string file; fields >> file;) {
+            set.files.push_back(file);
+        }
+        _assert(!set.files.empty(), "[batch] set %s has no exposures\n", set.name.c_str());
+        sets.push_back(set);
+    }
+    return sets;
+}
+
+static std::vector<BracketSet> read_directory(const std::string &directory) {
+    std::vector<BracketSet> sets;
+    for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+        if (!entry.is_directory()) {
+            continue;
+        }
+        BracketSet set;
+        set.name = entry.path().filename().string();
+        for (const auto &file : std::filesystem::directory_iterator(entry.path())) {
+            if (file.is_regular_file() && is_image(file.path())) {
+                set.files.push_back(file.path().string());
+            }
+        }
+        if (!set.files.empty()) {
+            std::sort(set.files.begin(), set.files.end());
+            sets.push_back(set);
+        }
+    }
+    std::sort(sets.begin(), sets.end(), [](const BracketSet &a, const BracketSet &b) { return a.name < b.name; });
+    return sets;
+}
+
+static double milliseconds_since(uint64_t start) {
+    return (nanosecond_timer() - start) / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    int decode_threads = 2, encode_threads = 2, queue_size = 2;
+    bool pyramid = false;
+    PngOptions png_options;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--decode-threads" && i + 1 < argc) {
+            decode_threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--encode-threads" && i + 1 < argc) {
+            encode_threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--queue" && i + 1 < argc) {
+            queue_size = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--png-level" && i + 1 < argc) {
+            png_options.level = std::stoi(argv[++i]);
+        } else if (arg == "--png-threads" && i + 1 < argc) {
+            png_options.threads = std::stoi(argv[++i]);
+        } else if (arg == "--pyramid") {
+            pyramid = true;
+        } else if (arg[0] != '-') {
+            paths.push_back(arg);
+        } else {
+            paths.clear();
+            break;
+        }
+    }
+    if (paths.size() != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--decode-threads N] [--encode-threads N] [--queue N] [--pyramid]"
+            << " [--png-level N] [--png-threads N]"
+            << " <manifest | directory> <output dir>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<BracketSet> sets = std::filesystem::is_directory(paths[0]) ? read_directory(paths[0])
+                                                                           : read_manifest(paths[0]);
+    std::filesystem::create_directories(paths[1]);
+
+    BoundedQueue<Job> decoded(queue_size), fused(queue_size);
+    uint64_t start = nanosecond_timer();
+
+    // Decode: each thread takes the next set not taken yet and loads its
+    // exposures one after the other. The last thread to finish closes the
+    // queue.
+    std::atomic<size_t> next_set(0);
+    std::atomic<int> decoding(decode_threads);
+    std::vector<std::thread> decoders;
+    for (int t = 0; t < decode_threads; t++) {
+        decoders.emplace_back([&]() {
+            for (size_t i = next_set++; i < sets.size(); i = next_set++) {
+                Job job;
+                job.index = i;
+                uint64_t s = nanosecond_timer();
+                try {
+                    job.frames = load_bracket<float>(sets[i].files, nullptr, 1);
+                    for (const Buffer<float> &frame : job.frames) {
+                        _assert(frame.width() == job.frames[0].width() && frame.height() == job.frames[0].height() &&
+                                frame.channels() == job.frames[0].channels(),
+                                "exposures differ in size\n");
+                    }
+                } catch (const ImageIOError &e) {
+                    job.frames.clear();
+                    job.error = e.what();
+                }
+                job.decode_ms = milliseconds_since(s);
+                decoded.push(std::move(job));
+            }
+            if (--decoding == 0) {
+                decoded.close();
+            }
+        });
+    }
+
+    // Encode: results are saved in the order they come out of compute.
+    // Failed sets pass through to be reported here with the others.
+    std::mutex print_lock;
+    std::atomic<size_t> failed(0);
+    std::vector<std::thread> encoders;
+    for (int t = 0; t < encode_threads; t++) {
+        encoders.emplace_back([&]() {
+            for (Job job; fused.pop(job);) {
+                uint64_t s = nanosecond_timer();
+                if (job.error.empty()) {
+                    try {
+                        save(job.fusion, (std::filesystem::path(paths[1]) / (sets[job.index].name + ".png")).string(), png_options);
+                    } catch (const ImageIOError &e) {
+                        job.error = e.what();
+                    }
+                }
+                double encode_ms = milliseconds_since(s);
+
+                std::lock_guard<std::mutex> guard(print_lock);
+                if (!job.error.empty()) {
+                    failed++;
+                    std::cerr << sets[job.index].name << ": failed: " << job.error << std::endl;
+                    continue;
+                }
+                std::cout << sets[job.index].name << ": " << sets[job.index].files.size() << " exposures,"
+                    << " decode " << job.decode_ms << " ms, compute " << job.compute_ms << " ms,"
+                    << " encode " << encode_ms << " ms" << std::endl;
+            }
+        });
+    }
+
+    // Compute, on this thread: Halide parallelizes each set over all cores.
+    double compute_ms = 0.0;
+    for (Job job; decoded.pop(job);) {
+        if (!job.error.empty()) {
+            fused.push(std::move(job));
+            continue;
+        }
+        uint64_t s = nanosecond_timer();
+        Buffer<float> weights = Measures::compute_bracket(job.frames);
+        job.fusion = pyramid ? Measures::compute_pyramid_fusion(job.frames, weights)
+                             : Measures::compute_fusion(job.frames, weights);
+        job.compute_ms = milliseconds_since(s);
+        compute_ms += job.compute_ms;
+
+        // Only the result waits for an encoder.
+        job.frames.clear();
+        fused.push(std::move(job));
+    }
+    fused.close();
+
+    for (std::thread &thread : decoders) {
+        thread.join();
+    }
+    for (std::thread &thread : encoders) {
+        thread.join();
+    }
+
+    // With I/O overlapped, the wall time approaches the compute time.
+    double wall_ms = milliseconds_since(start);
+    std::cout << sets.size() << " sets in " << wall_ms << " ms (" << sets.size() / (wall_ms / 1000) << " sets/s),"
+        << " compute busy " << 100 * compute_ms / std::max(wall_ms, 1e-9) << "% of the time" << std::endl;
+    if (failed > 0) {
+        std::cerr << failed << " of " << sets.size() << " sets failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
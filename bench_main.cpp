@@ -0,0 +1,277 @@
+// Benchmarks the stages of exposure fusion on synthetic brackets, sweeping
+// image size (thumbnail to 100 megapixels), exposure count (2 to 16), channel
+// count and the number of Halide threads. Prints one CSV table on stdout,
+// with a row per stage and run whose section column is one of:
+//
+//   - throughput: every stage for every size, exposure and channel count,
+//   - strong_scaling: a fixed bracket with 1..N threads,
+//   - weak_scaling: one megapixel per exposure per thread with 1..N threads.
+//
+// speedup and efficiency are filled in by the scaling sections; the
+// weights_root rows of the throughput section, which time the weights with
+// Schedule::Root, give the speedup of the default tiled schedule over it
+// in their speedup column. Sizes skipped because of --max-gb are reported
+// on stderr.
+//
+// Stages: weights (one compute() per exposure), weights_root (the same with
+// the compute_root schedule), normalized_weights (the weights of every
+// exposure, then their normalization in place, so the cost of normalization
+// is the difference with weights), fusion (blend with the normalized
+// weights, one exposure at a time), pyramid_fusion, png_save, png_save_strips (deflated in parallel
+// strips) and png_load (one exposure).
+// Throughput is in input megapixels, all exposures included, at the median
+// runtime.
+//
+// Usage: bench [--quick] [--max-gb N]
+//   --quick     only sizes up to 12 MP and brackets of up to 4 exposures
+//   --max-gb N  skip brackets whose float samples take more than N GB (8)
+
+#include "quality_measures.h"
+#include <timing.h>
+#include <image_io.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int sizes[][2] = {{320, 240}, {1280, 960}, {4000, 3000}, {6000, 4000}, {10000, 10000}};
+static const int exposure_counts[] = {2, 4, 8, 16};
+static const int channel_counts[] = {3, 4};
+
+// A bracket of a synthetic scene with detail at several scales and a
+// dynamic range wider than any single exposure, shot one stop apart. The
+// scene is separable in x and y, so it is tabulated per column and row and
+// each exposure is filled in parallel rows.
+static std::vector<Buffer<float>> synthetic_bracket(int width, int height, int channels, int exposures) {
+    // detail = 0.5 + 0.25 sin(400 u + c) cos(300 v) + 0.25 sin(40 (u + v)),
+    // with sin(40 (u + v)) expanded into products of u and v terms.
+    std::vector<float> fine_x((size_t) width * channels), coarse_sin_x(width), coarse_cos_x(width), radiance(width);
+    for (int x = 0; x < width; x++) {
+        float u = x / float(width);
+        for (int c = 0; c < channels; c++) {
+            fine_x[(size_t) c * width + x] = std::sin(u * 400.f + c);
+        }
+        coarse_sin_x[x] = std::sin(u * 40.f);
+        coarse_cos_x[x] = std::cos(u * 40.f);
+        radiance[x] = std::pow(10.f, 2.f * u - 1.f);
+    }
+    std::vector<float> fine_y(height), coarse_sin_y(height), coarse_cos_y(height);
+    for (int y = 0; y < height; y++) {
+        float v = y / float(height);
+        fine_y[y] = std::cos(v * 300.f);
+        coarse_sin_y[y] = std::sin(v * 40.f);
+        coarse_cos_y[y] = std::cos(v * 40.f);
+    }
+
+    std::vector<Buffer<float>> bracket;
+    for (int i = 0; i < exposures; i++) {
+        float exposure = std::pow(2.f, (float) (i - exposures / 2));
+        Buffer<float> frame(width, height, channels);
+
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                for (int c = 0; c < channels; c++) {
+                    for (int y = t; y < height; y += threads) {
+                        float *row = &frame(0, y, c);
+                        const float *fine = &fine_x[(size_t) c * width];
+                        for (int x = 0; x < width; x++) {
+                            float detail = 0.5f + 0.25f * fine[x] * fine_y[y] +
+                                           0.25f * (coarse_sin_x[x] * coarse_cos_y[y] + coarse_cos_x[x] * coarse_sin_y[y]);
+                            row[x] = std::min(std::max(detail * radiance[x] * exposure, 0.f), 1.f);
+                        }
+                    }
+                }
+            });
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        bracket.push_back(frame);
+    }
+    return bracket;
+}
+
+// Runtime statistics of f. Large inputs are run fewer times.
+static ProfileStats time_stage(const std::function<void()> &f, float megapixels) {
+    ProfileOptions options;
+    options.min_iterations = megapixels <= 50.f ? 5 : 1;
+    options.min_time_ms = megapixels <= 50.f ? 200.0 : 0.0;
+    return profile_callable(f, options);
+}
+
+// Prints a row of the CSV. speedup and efficiency are left empty when they
+// are NaN.
+static void print_row(const std::string &section, const std::string &stage, int width, int height,
+                      int channels, int exposures, int threads, const ProfileStats &stats, float megapixels,
+                      double speedup = NAN, double efficiency = NAN) {
+    std::cout << section << "," << stage << "," << width << "," << height << "," << channels << ","
+        << exposures << "," << threads << "," << stats.median_ms << "," << stats.min_ms << ","
+        << stats.p95_ms << "," << stats.stddev_ms << "," << stats.iterations << ","
+        << megapixels / (stats.median_ms / 1000) << ",";
+    if (!std::isnan(speedup)) {
+        std::cout << speedup;
+    }
+    std::cout << ",";
+    if (!std::isnan(efficiency)) {
+        std::cout << efficiency;
+    }
+    std::cout << std::endl;
+}
+
+// Times the compute stages of a bracket; each entry is (stage, statistics).
+static std::vector<std::pair<std::string, ProfileStats>> time_stages(const std::vector<Buffer<float>> &bracket) {
+    float megapixels = float(bracket[0].width()) * bracket[0].height() * bracket.size() / 1e6f;
+    std::vector<std::pair<std::string, ProfileStats>> times;
+
+    times.push_back({"weights", time_stage([&]() {
+        for (const Buffer<float> &frame : bracket) {
+            Measures::compute(frame);
+        }
+    }, megapixels)});
+
+    Buffer<float> normalized;
+    times.push_back({"normalized_weights", time_stage([&]() {
+        normalized = Measures::compute_bracket(bracket);
+    }, megapixels)});
+
+    times.push_back({"fusion", time_stage([&]() {
+        Measures::compute_fusion(bracket, normalized);
+    }, megapixels)});
+
+    times.push_back({"pyramid_fusion", time_stage([&]() {
+        Measures::compute_pyramid_fusion(bracket, normalized);
+    }, megapixels)});
+    return times;
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = false;
+    double max_bytes = 8e9;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--max-gb" && i + 1 < argc) {
+            max_bytes = std::stod(argv[++i]) * 1e9;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--max-gb N]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::cout << "section,stage,width,height,channels,exposures,threads,median_ms,min_ms,p95_ms,stddev_ms,runs,"
+        << "mpixels_per_s,speedup,efficiency" << std::endl;
+
+    // Throughput of every stage.
+    halide_set_num_threads(max_threads);
+    for (const int *size : sizes) {
+        int width = size[0], height = size[1];
+        if (quick && width * (double) height > 12e6) {
+            continue;
+        }
+
+        for (int channels : channel_counts) {
+            for (int exposures : exposure_counts) {
+                if (quick && exposures > 4) {
+                    continue;
+                }
+                // The bracket and its weights, which the fusions read in
+                // place, and about four frames of results and pyramid levels.
+                double bytes = (double) width * height * ((channels + 1) * exposures + 4 * channels) * sizeof(float);
+                if (bytes > max_bytes) {
+                    std::cerr << "skipped " << width << "x" << height << "x" << channels
+                        << " with " << exposures << " exposures: over --max-gb" << std::endl;
+                    continue;
+                }
+
+                std::vector<Buffer<float>> bracket = synthetic_bracket(width, height, channels, exposures);
+                float megapixels = float(width) * height * exposures / 1e6f;
+
+                std::vector<std::pair<std::string, ProfileStats>> times = time_stages(bracket);
+                for (const auto &stage : times) {
+                    print_row("throughput", stage.first, width, height, channels, exposures, max_threads,
+                              stage.second, megapixels);
+                }
+
+                // The original compute_root schedule of the weights, against
+                // the tiled one timed as "weights".
+                ProfileStats root = time_stage([&]() {
+                    for (const Buffer<float> &frame : bracket) {
+                        Measures::compute(frame, 1.f, 1.f, 1.f, Measures::DebugIntermediate::None,
+                                          Measures::Schedule::Root);
+                    }
+                }, megapixels);
+                print_row("throughput", "weights_root", width, height, channels, exposures, max_threads,
+                          root, megapixels, root.median_ms / times[0].second.median_ms);
+            }
+
+            // PNG I/O of one exposure.
+            Buffer<float> frame = synthetic_bracket(width, height, channels, 1)[0];
+            float megapixels = float(width) * height / 1e6f;
+            ProfileStats save_stats = time_stage([&]() { save(frame, "Output/bench.png"); }, megapixels);
+            PngOptions strips;
+            strips.threads = 0;
+            ProfileStats strips_stats = time_stage([&]() { save(frame, "Output/bench-strips.png", strips); }, megapixels);
+            ProfileStats load_stats = time_stage([&]() { load<float>("Output/bench.png"); }, megapixels);
+            print_row("throughput", "png_save", width, height, channels, 1, 1, save_stats, megapixels);
+            print_row("throughput", "png_save_strips", width, height, channels, 1, max_threads, strips_stats, megapixels);
+            print_row("throughput", "png_load", width, height, channels, 1, 1, load_stats, megapixels);
+        }
+    }
+
+    // Strong scaling: the same 12 MP, 4 exposure bracket on more threads.
+    {
+        const int width = 4000, height = 3000, channels = 3, exposures = 4;
+        std::vector<Buffer<float>> bracket = synthetic_bracket(width, height, channels, exposures);
+        float megapixels = float(width) * height * exposures / 1e6f;
+        std::vector<std::pair<std::string, ProfileStats>> single;
+        for (int threads : thread_counts) {
+            halide_set_num_threads(threads);
+            std::vector<std::pair<std::string, ProfileStats>> times = time_stages(bracket);
+            if (threads == 1) {
+                single = times;
+            }
+            for (size_t i = 0; i < times.size(); i++) {
+                double speedup = single[i].second.median_ms / times[i].second.median_ms;
+                print_row("strong_scaling", times[i].first, width, height, channels, exposures, threads,
+                          times[i].second, megapixels, speedup, speedup / threads);
+            }
+        }
+    }
+
+    // Weak scaling: one megapixel per exposure per thread.
+    {
+        const int channels = 3, exposures = 4;
+        std::vector<std::pair<std::string, ProfileStats>> single;
+        for (int threads : thread_counts) {
+            halide_set_num_threads(threads);
+            int width = 1000, height = 1000 * threads;
+            std::vector<Buffer<float>> bracket = synthetic_bracket(width, height, channels, exposures);
+            float megapixels = float(width) * height * exposures / 1e6f;
+            std::vector<std::pair<std::string, ProfileStats>> times = time_stages(bracket);
+            if (threads == 1) {
+                single = times;
+            }
+            for (size_t i = 0; i < times.size(); i++) {
+                print_row("weak_scaling", times[i].first, width, height, channels, exposures, threads,
+                          times[i].second, megapixels, NAN, single[i].second.median_ms / times[i].second.median_ms);
+            }
+        }
+    }
+
+    halide_set_num_threads(max_threads);
+    return EXIT_SUCCESS;
+}
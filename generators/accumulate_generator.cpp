@@ -0,0 +1,124 @@
+// Ahead-of-time pipelines behind Measures::compute_fusion and
+// Measures::compute_bracket, which take a bracket one exposure at a time so
+// that the exposures are read where they are rather than stacked into one
+// buffer first.
+//
+// measures_accumulate adds an exposure times its weight map to a running
+// sum, and measures_accumulate_u8 and measures_accumulate_u16 do the same
+// for 8 and 16-bit exposures. measures_add_weight adds a weight map to a
+// running sum of weights, and measures_normalize divides the first sum by
+// the second. measures_normalize_weights normalizes the weight maps (x, y, n)
+// of a whole bracket. Every output may be passed the buffer of the input it
+// updates: each reads its input at a pixel before writing it there, and
+// every loop guards its tail rather than shifting the last vector inwards,
+// which would update the pixels it overlaps twice.
+
+#include <Halide.h>
+#include "measures_algorithm.h"
+
+using namespace Halide;
+
+template<typename T>
+class AccumulateGenerator : public Generator<AccumulateGenerator<T>> {
+public:
+    GeneratorInput<Buffer<T>> frame{"frame", 3};
+    GeneratorInput<Buffer<float>> weight{"weight", 2};
+    GeneratorInput<Buffer<float>> sum{"sum", 3};
+
+    GeneratorOutput<Buffer<float>> accumulated{"accumulated", 3};
+
+    void generate() {
+        accumulated(x, y, c) = sum(x, y, c) + Measures::unit_float(frame(x, y, c)) * weight(x, y);
+    }
+
+    void schedule() {
+        // Every channel of a row is added before the next row, so each row
+        // of the weight map is read from memory once rather than per channel.
+        accumulated.reorder(x, c, y)
+                   .parallel(y)
+                   .vectorize(x, 8, TailStrategy::GuardWithIf);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class AddWeightGenerator : public Generator<AddWeightGenerator> {
+public:
+    Input<Buffer<float>> weight{"weight", 2};
+    Input<Buffer<float>> weight_sum{"weight_sum", 2};
+
+    Output<Buffer<float>> added{"added", 2};
+
+    void generate() {
+        added(x, y) = weight_sum(x, y) + weight(x, y);
+    }
+
+    void schedule() {
+        added.parallel(y)
+             .vectorize(x, 8, TailStrategy::GuardWithIf);
+    }
+
+private:
+    Var x{"x"}, y{"y"};
+};
+
+class NormalizeGenerator : public Generator<NormalizeGenerator> {
+public:
+    Input<Buffer<float>> sum{"sum", 3};
+    Input<Buffer<float>> weight_sum{"weight_sum", 2};
+
+    Output<Buffer<float>> normalized{"normalized", 3};
+
+    void generate() {
+        normalized(x, y, c) = sum(x, y, c) / weight_sum(x, y);
+    }
+
+    void schedule() {
+        normalized.reorder(x, c, y)
+                  .parallel(y)
+                  .vectorize(x, 8, TailStrategy::GuardWithIf);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class NormalizeWeightsGenerator : public Generator<NormalizeWeightsGenerator> {
+public:
+    Input<Buffer<float>> weights{"weights", 3};
+
+    Output<Buffer<float>> normalized{"normalized", 3};
+
+    void generate() {
+        RDom r(0, weights.dim(2).extent(), "r");
+        sum_weights(x, y) = 0.f;
+        sum_weights(x, y) += weights(x, y, r);
+
+        normalized(x, y, n) = weights(x, y, n) * (1.f / sum_weights(x, y));
+    }
+
+    void schedule() {
+        // The sum of a tile is taken over every exposure before any of them
+        // is normalized, which is what lets normalized be weights' buffer.
+        normalized.tile(x, y, xo, yo, xi, yi, Measures::weight_tile_width, Measures::weight_tile_height, TailStrategy::GuardWithIf)
+                  .reorder(xi, yi, n, xo, yo)
+                  .parallel(yo)
+                  .vectorize(xi, 8);
+        sum_weights.compute_at(normalized, xo)
+                   .vectorize(x, 8);
+        sum_weights.update()
+                   .vectorize(x, 8);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, n{"n"}, xo{"xo"}, yo{"yo"}, xi{"xi"}, yi{"yi"};
+    Func sum_weights{"sum_weights"};
+};
+
+HALIDE_REGISTER_GENERATOR(AccumulateGenerator<float>, measures_accumulate)
+HALIDE_REGISTER_GENERATOR(AccumulateGenerator<uint8_t>, measures_accumulate_u8)
+HALIDE_REGISTER_GENERATOR(AccumulateGenerator<uint16_t>, measures_accumulate_u16)
+HALIDE_REGISTER_GENERATOR(AddWeightGenerator, measures_add_weight)
+HALIDE_REGISTER_GENERATOR(NormalizeGenerator, measures_normalize)
+HALIDE_REGISTER_GENERATOR(NormalizeWeightsGenerator, measures_normalize_weights)
@@ -0,0 +1,46 @@
+// Ahead-of-time version of Measures::compute_bracket. Builds measures_bracket,
+// which computes the normalized weight maps (x, y, n) of every exposure of a
+// bracket in one pass. The exposures are separate inputs, read where they
+// are rather than stacked into one buffer, so each build is for one bracket
+// size, set with frames.size=N.
+
+#include <Halide.h>
+#include "measures_algorithm.h"
+
+using namespace Halide;
+
+class BracketGenerator : public Generator<BracketGenerator> {
+public:
+    // true builds the fast-math variant of the measures.
+    GeneratorParam<bool> fast_math{"fast_math", false};
+
+    Input<Buffer<float>[]> frames{"frames", 3};
+    Input<float> c_weight{"c_weight"};
+    Input<float> s_weight{"s_weight"};
+    Input<float> e_weight{"e_weight"};
+
+    Output<Buffer<float>> weights{"weights", 3};
+
+    void generate() {
+        std::vector<Func> clamped;
+        for (size_t i = 0; i < frames.size(); i++) {
+            Func frame("clamped_" + std::to_string(i));
+            frame(x, y, c) = frames[i](clamp(x, frames[i].dim(0).min(), frames[i].dim(0).max()),
+                                       clamp(y, frames[i].dim(1).min(), frames[i].dim(1).max()), c);
+            clamped.push_back(frame);
+        }
+
+        stages = Measures::define_bracket(clamped, c_weight, s_weight, e_weight, fast_math);
+        weights(x, y, n) = stages.normalized(x, y, n);
+    }
+
+    void schedule() {
+        Measures::schedule_bracket(stages, weights);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"}, n{"n"};
+    Measures::BracketStages stages;
+};
+
+HALIDE_REGISTER_GENERATOR(BracketGenerator, measures_bracket)
@@ -0,0 +1,214 @@
+// Ahead-of-time level kernels of Pyramid::blend, Pyramid::Accumulator and
+// Measures::ProgressiveFusion, each over (x, y, c) levels; weights have one
+// channel. Levels are stored as float or float16 and computed in float.
+//
+// Every kernel is built once per set of level types, given per buffer as
+// <name>.type=float32 or float16, and per channel count: channels > 0 builds
+// a kernel unrolled over that many channels, 0 one that takes any count. The
+// parallel schedule of the large levels and the serial one of the small
+// levels are specializations of the same function. The Makefile names each
+// build pyramid_<kernel>_c<channels>_<types>; see pyramid.cpp.
+
+#include <Halide.h>
+#include "pyramid_algorithm.h"
+#include "utils.h"
+
+using namespace Halide;
+
+class DownsampleGenerator : public Generator<DownsampleGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> in{"in", 3};
+
+    Output<Buffer<>> downsampled{"downsampled", 3};
+
+    void generate() {
+        Func clamped("clamped");
+        clamped(x, y, c) = cast<float>(BoundaryConditions::repeat_edge(in)(x, y, c));
+        downsampled(x, y, c) = cast(downsampled.type(), Pyramid::downsample(clamped)(x, y, c));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(downsampled, channels, downsampled.dim(0).extent(), downsampled.dim(1).extent());
+
+        // Slide the horizontal pass down each strip of rows, so every row of
+        // it is computed once.
+        Var yo("yo"), yi("yi");
+        find_func(downsampled, "downx").store_at(downsampled, yo)
+                                       .compute_at(downsampled, yi)
+                                       .vectorize(x, 8);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class ReduceGenerator : public Generator<ReduceGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> in{"in", 3};
+    // A power of two.
+    Input<int> factor{"factor"};
+
+    Output<Buffer<>> reduced{"reduced", 3};
+
+    void generate() {
+        Func clamped("clamped");
+        clamped(x, y, c) = cast<float>(BoundaryConditions::repeat_edge(in)(x, y, c));
+        reduced(x, y, c) = cast(reduced.type(), Pyramid::reduce(clamped, factor)(x, y, c));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(reduced, channels, reduced.dim(0).extent(), reduced.dim(1).extent());
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class AccumulateLevelGenerator : public Generator<AccumulateLevelGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> sum{"sum", 3};
+    Input<Buffer<>> fine{"fine", 3};
+    Input<Buffer<>> coarse{"coarse", 3};
+    Input<Buffer<>> weight{"weight", 3};
+
+    Output<Buffer<>> accumulated{"accumulated", 3};
+
+    void generate() {
+        Func clamped("clamped");
+        clamped(x, y, c) = cast<float>(BoundaryConditions::repeat_edge(coarse)(x, y, c));
+        Func up = Pyramid::upsample(clamped);
+        accumulated(x, y, c) = cast(accumulated.type(), cast<float>(sum(x, y, c)) +
+                                    (cast<float>(fine(x, y, c)) - up(x, y, c)) * cast<float>(weight(x, y, 0)));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(accumulated, channels, accumulated.dim(0).extent(), accumulated.dim(1).extent());
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class AccumulateTopGenerator : public Generator<AccumulateTopGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> sum{"sum", 3};
+    Input<Buffer<>> fine{"fine", 3};
+    Input<Buffer<>> weight{"weight", 3};
+
+    Output<Buffer<>> accumulated{"accumulated", 3};
+
+    void generate() {
+        accumulated(x, y, c) = cast(accumulated.type(), cast<float>(sum(x, y, c)) +
+                                    cast<float>(fine(x, y, c)) * cast<float>(weight(x, y, 0)));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(accumulated, channels, accumulated.dim(0).extent(), accumulated.dim(1).extent());
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class CollapseGenerator : public Generator<CollapseGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> level{"level", 3};
+    Input<Buffer<>> coarse{"coarse", 3};
+
+    Output<Buffer<>> collapsed{"collapsed", 3};
+
+    void generate() {
+        Func clamped("clamped");
+        clamped(x, y, c) = cast<float>(BoundaryConditions::repeat_edge(coarse)(x, y, c));
+        Func up = Pyramid::upsample(clamped);
+        collapsed(x, y, c) = cast(collapsed.type(), cast<float>(level(x, y, c)) + up(x, y, c));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(collapsed, channels, collapsed.dim(0).extent(), collapsed.dim(1).extent());
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class AddLevelGenerator : public Generator<AddLevelGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> sum{"sum", 3};
+    Input<Buffer<>> level{"level", 3};
+
+    Output<Buffer<>> added{"added", 3};
+
+    void generate() {
+        added(x, y, c) = cast(added.type(), cast<float>(sum(x, y, c)) + cast<float>(level(x, y, c)));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(added, channels, added.dim(0).extent(), added.dim(1).extent());
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class NormalizeLevelGenerator : public Generator<NormalizeLevelGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> sum{"sum", 3};
+    Input<Buffer<>> weight_sum{"weight_sum", 3};
+
+    Output<Buffer<>> normalized{"normalized", 3};
+
+    void generate() {
+        normalized(x, y, c) = cast(normalized.type(), cast<float>(sum(x, y, c)) / cast<float>(weight_sum(x, y, 0)));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(normalized, channels, normalized.dim(0).extent(), normalized.dim(1).extent());
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+class ConvertLevelGenerator : public Generator<ConvertLevelGenerator> {
+public:
+    GeneratorParam<int> channels{"channels", 0};
+
+    Input<Buffer<>> level{"level", 3};
+
+    Output<Buffer<>> converted{"converted", 3};
+
+    void generate() {
+        converted(x, y, c) = cast(converted.type(), level(x, y, c));
+    }
+
+    void schedule() {
+        Pyramid::schedule_level(converted, channels, converted.dim(0).extent(), converted.dim(1).extent());
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+};
+
+HALIDE_REGISTER_GENERATOR(DownsampleGenerator, pyramid_downsample)
+HALIDE_REGISTER_GENERATOR(ReduceGenerator, pyramid_reduce)
+HALIDE_REGISTER_GENERATOR(AccumulateLevelGenerator, pyramid_accumulate)
+HALIDE_REGISTER_GENERATOR(AccumulateTopGenerator, pyramid_accumulate_top)
+HALIDE_REGISTER_GENERATOR(CollapseGenerator, pyramid_collapse)
+HALIDE_REGISTER_GENERATOR(AddLevelGenerator, pyramid_add)
+HALIDE_REGISTER_GENERATOR(NormalizeLevelGenerator, pyramid_normalize)
+HALIDE_REGISTER_GENERATOR(ConvertLevelGenerator, pyramid_convert)
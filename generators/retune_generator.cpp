@@ -0,0 +1,88 @@
+// Ahead-of-time pipelines of Measures::TuningSession. measures_log_measures
+// computes the log contrast, saturation and exposure of one exposure, which
+// don't depend on the exponents. measures_retune fuses a bracket from them
+// with new exponents in one pass, and measures_retune_weights gives the
+// normalized weight maps instead, for the pyramid blend.
+
+#include <Halide.h>
+#include "measures_algorithm.h"
+
+using namespace Halide;
+
+class LogMeasuresGenerator : public Generator<LogMeasuresGenerator> {
+public:
+    Input<Buffer<float>> input{"input", 3};
+
+    Output<Buffer<float>> planes{"planes", 3};
+
+    void generate() {
+        Func clamped("clamped");
+        clamped(x, y, c) = input(clamp(x, input.dim(0).min(), input.dim(0).max()),
+                                 clamp(y, input.dim(1).min(), input.dim(1).max()), c);
+
+        // The exponents don't matter, only the measures are used.
+        stages = Measures::define_weight(clamped, 1.f, 1.f, 1.f);
+        planes(x, y, m) = Measures::define_log_measures(stages)(x, y, m);
+    }
+
+    void schedule() {
+        Measures::schedule_log_measures(stages, planes);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"}, m{"m"};
+    Measures::WeightStages stages;
+};
+
+class RetuneGenerator : public Generator<RetuneGenerator> {
+public:
+    Input<Buffer<float>> frames{"frames", 4};
+    Input<Buffer<float>> log_measures{"log_measures", 4};
+    Input<float> c_weight{"c_weight"};
+    Input<float> s_weight{"s_weight"};
+    Input<float> e_weight{"e_weight"};
+
+    Output<Buffer<float>> fusion{"fusion", 3};
+
+    void generate() {
+        stages = Measures::define_retune(log_measures, frames.dim(3).extent(), c_weight, s_weight, e_weight);
+        blend = Measures::define_blend(frames, stages.normalized, frames.dim(3).extent());
+        fusion(x, y, c) = blend(x, y, c);
+    }
+
+    void schedule() {
+        Measures::schedule_retune(stages, fusion, blend);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+    Measures::RetuneStages stages;
+    Func blend;
+};
+
+class RetuneWeightsGenerator : public Generator<RetuneWeightsGenerator> {
+public:
+    Input<Buffer<float>> log_measures{"log_measures", 4};
+    Input<float> c_weight{"c_weight"};
+    Input<float> s_weight{"s_weight"};
+    Input<float> e_weight{"e_weight"};
+
+    Output<Buffer<float>> weights{"weights", 3};
+
+    void generate() {
+        stages = Measures::define_retune(log_measures, log_measures.dim(3).extent(), c_weight, s_weight, e_weight);
+        weights(x, y, n) = stages.normalized(x, y, n);
+    }
+
+    void schedule() {
+        Measures::schedule_retune(stages, weights);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, n{"n"};
+    Measures::RetuneStages stages;
+};
+
+HALIDE_REGISTER_GENERATOR(LogMeasuresGenerator, measures_log_measures)
+HALIDE_REGISTER_GENERATOR(RetuneGenerator, measures_retune)
+HALIDE_REGISTER_GENERATOR(RetuneWeightsGenerator, measures_retune_weights)
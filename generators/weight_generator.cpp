@@ -0,0 +1,102 @@
+// Ahead-of-time version of Measures::compute. Builds measures_weight, which
+// computes the weight map of one exposure without JIT-compiling at runtime,
+// and measures_weight_u8 and measures_weight_u16, which take the samples of
+// 8 and 16-bit files as they are and normalize them where they are read.
+// measures_intermediates outputs every debug intermediate of
+// Measures::compute_intermediates, and the weight map, in one pass.
+
+#include <Halide.h>
+#include "measures_algorithm.h"
+
+using namespace Halide;
+
+template<typename T>
+class WeightGenerator : public Generator<WeightGenerator<T>> {
+public:
+    // false builds the compute_root fallback schedule.
+    GeneratorParam<bool> tiled{"tiled", true};
+    // true builds the fast-math variant of the measures.
+    GeneratorParam<bool> fast_math{"fast_math", false};
+
+    GeneratorInput<Buffer<T>> input{"input", 3};
+    // Inputs rather than constants, so one build serves every set of
+    // exponents.
+    GeneratorInput<float> c_weight{"c_weight"};
+    GeneratorInput<float> s_weight{"s_weight"};
+    GeneratorInput<float> e_weight{"e_weight"};
+
+    GeneratorOutput<Buffer<float>> weight_map{"weight_map", 2};
+
+    void generate() {
+        // Clamp to the extent of the input buffer, wherever it starts, so the
+        // laplacian stencil can read one pixel past the border.
+        Func clamped("clamped");
+        clamped(x, y, c) = Measures::unit_float(input(clamp(x, input.dim(0).min(), input.dim(0).max()),
+                                                      clamp(y, input.dim(1).min(), input.dim(1).max()), c));
+
+        stages = Measures::define_weight(clamped, c_weight, s_weight, e_weight, fast_math);
+        weight_map(x, y) = stages.weight(x, y);
+    }
+
+    void schedule() {
+        if (tiled) {
+            Measures::schedule_weight_tiled(stages, weight_map);
+        } else {
+            Measures::schedule_weight_root(stages);
+        }
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+    Measures::WeightStages stages;
+};
+
+class IntermediatesGenerator : public Generator<IntermediatesGenerator> {
+public:
+    // true builds the fast-math variant of the measures.
+    GeneratorParam<bool> fast_math{"fast_math", false};
+
+    Input<Buffer<float>> input{"input", 3};
+    Input<float> c_weight{"c_weight"};
+    Input<float> s_weight{"s_weight"};
+    Input<float> e_weight{"e_weight"};
+
+    Output<Buffer<float>> grayscale{"grayscale_out", 2};
+    Output<Buffer<float>> laplacian{"laplacian", 2};
+    Output<Buffer<float>> contrast{"contrast", 2};
+    Output<Buffer<float>> saturation{"saturation", 2};
+    Output<Buffer<float>> exposure{"exposure", 2};
+    Output<Buffer<float>> weight_map{"weight_map", 2};
+
+    void generate() {
+        Func clamped("clamped");
+        clamped(x, y, c) = input(clamp(x, input.dim(0).min(), input.dim(0).max()),
+                                 clamp(y, input.dim(1).min(), input.dim(1).max()), c);
+
+        stages = Measures::define_weight(clamped, c_weight, s_weight, e_weight, fast_math);
+
+        // The laplacian reads grayscale past the border, which an output
+        // buffer can't provide, so output a copy of it, named apart from the
+        // stage so the pipeline doesn't have two Funcs called grayscale. The
+        // other stages are the outputs themselves.
+        grayscale(x, y) = stages.grayscale(x, y);
+        laplacian = stages.laplacian;
+        contrast = stages.contrast;
+        saturation = stages.saturation;
+        exposure = stages.exposure;
+        weight_map = stages.weight;
+    }
+
+    void schedule() {
+        Measures::schedule_weight_outputs(stages, {grayscale, laplacian, contrast, saturation, exposure, weight_map}, true);
+    }
+
+private:
+    Var x{"x"}, y{"y"}, c{"c"};
+    Measures::WeightStages stages;
+};
+
+HALIDE_REGISTER_GENERATOR(WeightGenerator<float>, measures_weight)
+HALIDE_REGISTER_GENERATOR(WeightGenerator<uint8_t>, measures_weight_u8)
+HALIDE_REGISTER_GENERATOR(WeightGenerator<uint16_t>, measures_weight_u16)
+HALIDE_REGISTER_GENERATOR(IntermediatesGenerator, measures_intermediates)
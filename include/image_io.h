@@ -1,25 +1,82 @@
-// This simple PNG IO library works with *both* the Halide::Image<T> type *and*
-// the simple static_image.h version. Also now includes PPM support for faster load/save.
-// If you want the static_image.h version, to use in a program statically
-// linking against a Halide pipeline pre-compiled with Func::compile_to_file, you
-// need to explicitly #include static_image.h first.
+// This simple PNG IO library works with *both* the Halide::Buffer<T> type *and*
+// the Halide::Runtime::Buffer<T> of HalideBuffer.h. Also now includes JPEG support, and PPM and PFM support, memory-mapped, for faster load/save,
+// and an uncompressed raw dump format for intermediates of any type.
+// Programs that JIT-compile include Halide.h first and get Halide::Buffer.
+// The others, which only call pipelines compiled ahead of time and don't
+// link libHalide, get Halide::Runtime::Buffer.
 
 #ifndef STATIC_IMAGE_LOADER_H
 #define STATIC_IMAGE_LOADER_H
 
 #include <png.h>
+#include <zlib.h>
 #include <string>
 #include <stdio.h>
+extern "C" {
+#include <jpeglib.h>
+}
 #include <algorithm>
 #include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <ctype.h>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifndef HALIDE_H
+#include <HalideBuffer.h>
+#endif
+#include <pixel_convert.h>
+
+#if defined(__unix__) || defined(__unix) || defined(__APPLE__)
+#define IMAGE_IO_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
-#include <Halide.h>
-
-using namespace Halide;
+#ifdef HALIDE_H
+using Halide::Buffer;
+#else
+using Halide::Runtime::Buffer;
+#endif
 
 //#include <sys/time.h>
 
-#define _assert(condition, ...) if (!(condition)) {fprintf(stderr, __VA_ARGS__); exit(-1);}
+/**
+ * Thrown by the loaders and savers on a missing, unsupported or corrupt
+ * file, so that a program reading many files can report the bad one and
+ * carry on. Uncaught, it ends the program with the message.
+ */
+struct ImageIOError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// The printf-formatted message of an ImageIOError, without the newline the
+// messages end with.
+inline std::string image_io_message(const char *format, ...) {
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    std::string result(message);
+    while (!result.empty() && result.back() == '\n') {
+        result.pop_back();
+    }
+    return result;
+}
+
+#define _assert(condition, ...) if (!(condition)) {throw ImageIOError(image_io_message(__VA_ARGS__));}
 
 // Convert to u8
 inline void convert(uint8_t in, uint8_t &out) {out = in;}
@@ -41,6 +98,9 @@ inline void convert(int32_t in, uint16_t &out) {out = in >> 16;}
 inline void convert(float in, uint16_t &out) {out = (uint16_t)(in*65535.0f);}
 inline void convert(double in, uint16_t &out) {out = (uint16_t)(in*65535.0f);}
 
+// Convert to float
+inline void convert(float in, float &out) {out = in;}
+
 // Convert from u8
 inline void convert(uint8_t in, uint32_t &out) {out = in << 24;}
 inline void convert(uint8_t in, int8_t &out) {out = in;}
@@ -65,28 +125,80 @@ inline bool ends_with_ignore_case(std::string a, std::string b) {
     return a.compare(a.length()-b.length(), b.length(), b) == 0;
 }
 
+inline int is_little_endian() {
+    int value = 1;
+    return ((char *) &value)[0] == 1;
+}
+
+// Deinterleave and convert one row of a decoded PNG into the planar row at
+// dst, whose channels are c_stride apart. The channel count is a template
+// parameter so the loads have a constant stride and the loops vectorize.
+template<typename T, typename S, int channels>
+inline void convert_png_row(const S *src, T *dst, int c_stride, int width) {
+    for (int c = 0; c < channels; c++) {
+        T *out = dst + c * c_stride;
+        for (int x = 0; x < width; x++) {
+            convert(src[x * channels + c], out[x]);
+        }
+    }
+}
+
+template<typename T, typename S>
+inline void convert_png_row(const S *src, T *dst, int c_stride, int width, int channels) {
+    switch (channels) {
+        case 1: convert_png_row<T, S, 1>(src, dst, c_stride, width); break;
+        case 2: convert_png_row<T, S, 2>(src, dst, c_stride, width); break;
+        case 3: convert_png_row<T, S, 3>(src, dst, c_stride, width); break;
+        case 4: convert_png_row<T, S, 4>(src, dst, c_stride, width); break;
+    }
+}
+
+// Closes a file being decoded and frees its libpng state however the
+// decoder returns.
+struct PngReadState {
+    FILE *f = nullptr;
+    png_structp png_ptr = nullptr;
+    png_infop info_ptr = nullptr;
+
+    PngReadState() = default;
+    PngReadState(const PngReadState &) = delete;
+    PngReadState &operator=(const PngReadState &) = delete;
+    ~PngReadState() {
+        if (png_ptr) {
+            png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : NULL, NULL);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+};
+
 template<typename T>
 Buffer<T> load_png(std::string filename) {
     png_byte header[8];
-    png_structp png_ptr;
-    png_infop info_ptr;
-    png_bytep *row_pointers;
+    PngReadState state;
 
     /* open file and test for it being a png */
-    FILE *f = fopen(filename.c_str(), "rb");
+    FILE *f = state.f = fopen(filename.c_str(), "rb");
     _assert(f, "File %s could not be opened for reading\n", filename.c_str());
     _assert(fread(header, 1, 8, f) == 8, "File ended before end of header\n");
     _assert(!png_sig_cmp(header, 0, 8), "File %s is not recognized as a PNG file\n", filename.c_str());
 
     /* initialize stuff */
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_structp png_ptr = state.png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 
     _assert(png_ptr, "png_create_read_struct failed\n");
 
-    info_ptr = png_create_info_struct(png_ptr);
+    png_infop info_ptr = state.info_ptr = png_create_info_struct(png_ptr);
     _assert(info_ptr, "png_create_info_struct failed\n");
 
-    _assert(!setjmp(png_jmpbuf(png_ptr)), "Error during init_io\n");
+    // Everything libpng's error handler jumps over is constructed before the
+    // setjmp, so nothing is skipped on the way back.
+    Buffer<T> im(1);
+    std::vector<png_byte> rows;
+    std::vector<png_bytep> row_pointers;
+
+    _assert(!setjmp(png_jmpbuf(png_ptr)), "Error during init_io in %s\n", filename.c_str());
 
     png_init_io(png_ptr, f);
     png_set_sig_bytes(png_ptr, 8);
@@ -97,81 +209,415 @@ Buffer<T> load_png(std::string filename) {
     int height = png_get_image_height(png_ptr, info_ptr);
     int channels = png_get_channels(png_ptr, info_ptr);
     int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    bool interlaced = png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE;
 
     // Expand low-bpp images to have only 1 pixel per byte (As opposed to tight packing)
     if (bit_depth < 8) {
         png_set_packing(png_ptr);
     }
 
-    Buffer<T> im(1);
+    _assert(bit_depth == 8 || bit_depth == 16, "Can only handle 8-bit or 16-bit pngs\n");
+
+    // Float images are converted by the vector kernels, which swap the
+    // big-endian 16-bit samples themselves; otherwise have libpng hand them
+    // over in host byte order.
+    const bool vector_kernels = std::is_same<T, float>::value;
+    if (bit_depth == 16 && is_little_endian() && !vector_kernels) {
+        png_set_swap(png_ptr);
+    }
+
     if (channels != 1) {
         im = Buffer<T>(width, height, channels);
     } else {
         im = Buffer<T>(width, height);
     }
 
-    png_set_interlace_handling(png_ptr);
+    if (interlaced) {
+        png_set_interlace_handling(png_ptr);
+    }
     png_read_update_info(png_ptr, info_ptr);
 
     // read the file
-    _assert(!setjmp(png_jmpbuf(png_ptr)), "Error during read_image\n");
+    _assert(!setjmp(png_jmpbuf(png_ptr)), "Error during read_image in %s\n", filename.c_str());
 
-    row_pointers = new png_bytep[im.height()];
-    for (int y = 0; y < im.height(); y++) {
-        row_pointers[y] = new png_byte[png_get_rowbytes(png_ptr, info_ptr)];
-    }
+    size_t row_bytes = png_get_rowbytes(png_ptr, info_ptr);
+    int c_stride = (im.channels() == 1) ? 0 : im.stride(2);
 
-    png_read_image(png_ptr, row_pointers);
+    auto convert_row = [&](const png_byte *row, int y) {
+        T *dst = (T *) im.data() + (size_t) y * im.stride(1);
+        if constexpr (std::is_same<T, float>::value) {
+            if (bit_depth == 8) {
+                PixelConvert::deinterleave(row, dst, width, channels, c_stride);
+            } else {
+                PixelConvert::deinterleave((const uint16_t *) row, dst, width, channels, c_stride, is_little_endian());
+            }
+        } else if (bit_depth == 8) {
+            convert_png_row(row, dst, c_stride, width, channels);
+        } else {
+            convert_png_row((const uint16_t *) row, dst, c_stride, width, channels);
+        }
+    };
+
+    if (!interlaced) {
+        // Decode one row at a time into a single scratch row, converting
+        // each into the image as it arrives.
+        rows.resize(row_bytes);
+        for (int y = 0; y < height; y++) {
+            png_read_row(png_ptr, rows.data(), NULL);
+            convert_row(rows.data(), y);
+        }
+    } else {
+        // The passes of an interlaced image each cover the whole image, so
+        // it is decoded whole before being converted.
+        rows.resize(row_bytes * height);
+        row_pointers.resize(height);
+        for (int y = 0; y < height; y++) {
+            row_pointers[y] = &rows[row_bytes * y];
+        }
+        png_read_image(png_ptr, row_pointers.data());
+        for (int y = 0; y < height; y++) {
+            convert_row(row_pointers[y], y);
+        }
+    }
 
-    fclose(f);
+    im.set_host_dirty();
+    return im;
+}
 
-    _assert((bit_depth == 8) || (bit_depth == 16), "Can only handle 8-bit or 16-bit pngs\n");
+/**
+ * PNG filter applied to every row before compression. Adaptive picks the
+ * filter of each row that minimizes the sum of its absolute values, as
+ * libpng does by default.
+ */
+enum class PngFilter {
+    Adaptive,
+    None,
+    Sub,
+    Up,
+    Average,
+    Paeth
+};
+
+/**
+ * How save_png encodes. The defaults give libpng's output.
+ *
+ * level is the zlib level, 0 (stored) to 9, or -1 for zlib's default (6).
+ * threads other than 1 (0 for one per core) or strip_rows other than 0
+ * deflate strips of strip_rows rows (0 picks) independently, on worker
+ * threads, and stitch them into one IDAT stream: much faster on large
+ * images for files a little larger.
+ */
+struct PngOptions {
+    int level = -1;
+    PngFilter filter = PngFilter::Adaptive;
+    int threads = 1;
+    int strip_rows = 0;
+};
+
+// Convert row y of im to the big-endian, interleaved samples of a PNG row.
+template<typename T>
+inline void png_encode_row(Buffer<T> &im, int y, int bit_depth, uint8_t *dstPtr) {
+    int c_stride = (im.channels() == 1) ? 0 : im.stride(2);
+    T *srcPtr = (T*)im.data() + (size_t) y * im.stride(1);
 
-    // convert the data to T
+    if constexpr (std::is_same<T, float>::value) {
+        // PNG samples are big-endian.
+        if (bit_depth == 16) {
+            PixelConvert::interleave(srcPtr, c_stride, (uint16_t *) dstPtr, im.width(), im.channels(), is_little_endian());
+        } else {
+            PixelConvert::interleave(srcPtr, c_stride, dstPtr, im.width(), im.channels());
+        }
+    } else if (bit_depth == 16) {
+        // convert to uint16_t
+        for (int x = 0; x < im.width(); x++) {
+            for (int c = 0; c < im.channels(); c++) {
+                uint16_t out;
+                convert(srcPtr[c*c_stride], out);
+                *dstPtr++ = out >> 8;
+                *dstPtr++ = out & 0xff;
+            }
+            srcPtr++;
+        }
+    } else if (bit_depth == 8) {
+        // convert to uint8_t
+        for (int x = 0; x < im.width(); x++) {
+            for (int c = 0; c < im.channels(); c++) {
+                uint8_t out;
+                convert(srcPtr[c*c_stride], out);
+                *dstPtr++ = out;
+            }
+            srcPtr++;
+        }
+    } else {
+        _assert(bit_depth == 8 || bit_depth == 16, "We only support saving 8- and 16-bit images.");
+    }
+}
 
-    int c_stride = (im.channels() == 1) ? 0 : im.stride(2);
-    T *ptr = (T*)im.data();
-    if (bit_depth == 8) {
-        for (int y = 0; y < im.height(); y++) {
-            uint8_t *srcPtr = (uint8_t *)(row_pointers[y]);
-            for (int x = 0; x < im.width(); x++) {
-                for (int c = 0; c < im.channels(); c++) {
-                    convert(*srcPtr++, ptr[c*c_stride]);
-                }
-                ptr++;
+// Filter one row of n bytes, bpp bytes per pixel, with filter f (not
+// Adaptive) into dst. prior is the row above, zeros for the first row.
+inline void png_apply_filter(PngFilter f, const uint8_t *row, const uint8_t *prior, size_t n, int bpp, uint8_t *dst) {
+    size_t left = std::min(n, (size_t) bpp);
+    switch (f) {
+        case PngFilter::Sub:
+            memcpy(dst, row, left);
+            for (size_t i = left; i < n; i++) {
+                dst[i] = row[i] - row[i - bpp];
+            }
+            break;
+        case PngFilter::Up:
+            for (size_t i = 0; i < n; i++) {
+                dst[i] = row[i] - prior[i];
+            }
+            break;
+        case PngFilter::Average:
+            for (size_t i = 0; i < left; i++) {
+                dst[i] = row[i] - (prior[i] >> 1);
+            }
+            for (size_t i = left; i < n; i++) {
+                dst[i] = row[i] - ((row[i - bpp] + prior[i]) >> 1);
             }
+            break;
+        case PngFilter::Paeth:
+            for (size_t i = 0; i < left; i++) {
+                dst[i] = row[i] - prior[i];
+            }
+            for (size_t i = left; i < n; i++) {
+                int a = row[i - bpp], b = prior[i], c = prior[i - bpp];
+                int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+                dst[i] = row[i] - ((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c));
+            }
+            break;
+        default:
+            memcpy(dst, row, n);
+            break;
+    }
+}
+
+// Filter one row into out, whose first byte is the filter type.
+inline void png_filter_row(const uint8_t *row, const uint8_t *prior, size_t n, int bpp, PngFilter filter,
+                           uint8_t *out, std::vector<uint8_t> &scratch) {
+    if (filter != PngFilter::Adaptive) {
+        out[0] = (uint8_t) ((int) filter - (int) PngFilter::None);
+        png_apply_filter(filter, row, prior, n, bpp, out + 1);
+        return;
+    }
+
+    // Keep the filter whose output has the smallest sum of absolute values,
+    // reading bytes as signed.
+    scratch.resize(n);
+    uint64_t best_sum = UINT64_MAX;
+    for (PngFilter f : {PngFilter::None, PngFilter::Sub, PngFilter::Up, PngFilter::Average, PngFilter::Paeth}) {
+        png_apply_filter(f, row, prior, n, bpp, scratch.data());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += abs((int8_t) scratch[i]);
         }
-    } else if (bit_depth == 16) {
-        for (int y = 0; y < im.height(); y++) {
-            uint8_t *srcPtr = (uint8_t *)(row_pointers[y]);
-            for (int x = 0; x < im.width(); x++) {
-                for (int c = 0; c < im.channels(); c++) {
-                    uint16_t hi = (*srcPtr++) << 8;
-                    uint16_t lo = hi | (*srcPtr++);
-                    convert(lo, ptr[c*c_stride]);
+        if (sum < best_sum) {
+            best_sum = sum;
+            out[0] = (uint8_t) ((int) f - (int) PngFilter::None);
+            memcpy(out + 1, scratch.data(), n);
+        }
+    }
+}
+
+// Run f(i) for i in [0, n) on threads threads, each taking the next i. The
+// first exception f throws stops the workers and is rethrown once they are
+// joined, so it reaches the caller rather than terminating a worker thread.
+template<typename F>
+inline void run_parallel(int n, int threads, F f) {
+    std::atomic<int> next(0);
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    auto worker = [&]() {
+        for (int i = next++; i < n && !failed; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = std::current_exception();
                 }
-                ptr++;
+                return;
             }
         }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < std::min(threads, n); t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool) {
+        thread.join();
     }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
 
-    // clean up
-    for (int y = 0; y < im.height(); y++) {
-        delete[] row_pointers[y];
+// Closes a file being encoded and frees its libpng state however the
+// encoder returns.
+struct PngWriteState {
+    FILE *f = nullptr;
+    png_structp png_ptr = nullptr;
+    png_infop info_ptr = nullptr;
+
+    PngWriteState() = default;
+    PngWriteState(const PngWriteState &) = delete;
+    PngWriteState &operator=(const PngWriteState &) = delete;
+    ~PngWriteState() {
+        if (png_ptr) {
+            png_destroy_write_struct(&png_ptr, info_ptr ? &info_ptr : NULL);
+        }
+        if (f) {
+            fclose(f);
+        }
     }
-    delete[] row_pointers;
+};
+
+// Ends a raw deflate stream of the strip encoder however its strip returns.
+struct DeflateState {
+    z_stream stream = {};
+    bool initialized = false;
+
+    DeflateState() = default;
+    DeflateState(const DeflateState &) = delete;
+    DeflateState &operator=(const DeflateState &) = delete;
+    ~DeflateState() {
+        if (initialized) {
+            deflateEnd(&stream);
+        }
+    }
+};
+
+// Append a PNG chunk, its length and CRC included.
+inline void png_write_chunk(FILE *f, const char *type, const uint8_t *data, size_t length) {
+    _assert(length < (1u << 31), "PNG chunk too large\n");
+    uint8_t header[8] = {(uint8_t) (length >> 24), (uint8_t) (length >> 16), (uint8_t) (length >> 8), (uint8_t) length,
+                         (uint8_t) type[0], (uint8_t) type[1], (uint8_t) type[2], (uint8_t) type[3]};
+    uLong crc = crc32(0, header + 4, 4);
+    if (length > 0) {
+        crc = crc32(crc, data, (uInt) length);
+    }
+    uint8_t footer[4] = {(uint8_t) (crc >> 24), (uint8_t) (crc >> 16), (uint8_t) (crc >> 8), (uint8_t) crc};
+    _assert(fwrite(header, 1, 8, f) == 8 && (length == 0 || fwrite(data, 1, length, f) == length) &&
+            fwrite(footer, 1, 4, f) == 4,
+            "[write_png_file] Error during writing bytes\n");
+}
 
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+/**
+ * The strip encoder of save_png: rows are converted and filtered in
+ * parallel, then strips of rows are deflated on worker threads as raw
+ * deflate streams. Every strip but the last ends with a sync flush, so the
+ * strips concatenate into one stream, and each is primed with the 32 KB of
+ * filtered rows before it, so matches can still reach back across strips.
+ * The zlib header and the combined Adler-32 of the strips wrap the stream,
+ * and each strip is written as its own IDAT chunk.
+ */
+template<typename T>
+void save_png_strips(Buffer<T> im, std::string filename, const PngOptions &options,
+                     int bit_depth, png_byte color_type) {
+    int width = im.width(), height = im.height();
+    int bpp = im.channels() * bit_depth / 8;
+    size_t row_bytes = (size_t) width * bpp;
+    size_t filtered_bytes = row_bytes + 1;
+
+    int threads = options.threads > 0 ? options.threads : (int) std::max(1u, std::thread::hardware_concurrency());
+    int strip_rows = options.strip_rows;
+    if (strip_rows <= 0) {
+        // A few strips per thread, of at least 256 KB each.
+        strip_rows = std::max((height + 4 * threads - 1) / (4 * threads), (int) ((1 << 18) / filtered_bytes) + 1);
+    }
+    int strips = (height + strip_rows - 1) / strip_rows;
+
+    std::vector<uint8_t> raw(row_bytes * height);
+    run_parallel(height, threads, [&](int y) {
+        png_encode_row(im, y, bit_depth, &raw[row_bytes * y]);
+    });
+
+    std::vector<uint8_t> filtered(filtered_bytes * height), zeros(row_bytes);
+    run_parallel(strips, threads, [&](int k) {
+        std::vector<uint8_t> scratch;
+        for (int y = k * strip_rows; y < std::min(height, (k + 1) * strip_rows); y++) {
+            png_filter_row(&raw[row_bytes * y], y > 0 ? &raw[row_bytes * (y - 1)] : zeros.data(), row_bytes, bpp,
+                           options.filter, &filtered[filtered_bytes * y], scratch);
+        }
+    });
+    raw = std::vector<uint8_t>();
+
+    std::vector<std::vector<uint8_t>> deflated(strips);
+    std::vector<uLong> adlers(strips);
+    run_parallel(strips, threads, [&](int k) {
+        size_t begin = filtered_bytes * k * strip_rows;
+        size_t length = filtered_bytes * (std::min(height, (k + 1) * strip_rows) - k * strip_rows);
+        const uint8_t *input = &filtered[begin];
+        adlers[k] = adler32(adler32(0, Z_NULL, 0), input, (uInt) length);
+
+        DeflateState state;
+        z_stream &stream = state.stream;
+        state.initialized = deflateInit2(&stream, options.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        _assert(state.initialized, "[write_png_file] deflateInit2 failed\n");
+        if (k > 0) {
+            size_t dictionary = std::min(begin, (size_t) 32768);
+            deflateSetDictionary(&stream, input - dictionary, (uInt) dictionary);
+        }
 
-    im.set_host_dirty();
-    return im;
+        std::vector<uint8_t> &out = deflated[k];
+        out.resize(deflateBound(&stream, length) + 64);
+        stream.next_in = (Bytef *) input;
+        stream.avail_in = (uInt) length;
+        int flush = k == strips - 1 ? Z_FINISH : Z_SYNC_FLUSH;
+        size_t produced = 0;
+        while (true) {
+            stream.next_out = &out[produced];
+            stream.avail_out = (uInt) (out.size() - produced);
+            int result = deflate(&stream, flush);
+            _assert(result == Z_OK || result == Z_STREAM_END || result == Z_BUF_ERROR,
+                    "[write_png_file] deflate failed\n");
+            produced = out.size() - stream.avail_out;
+            if (stream.avail_out > 0 && stream.avail_in == 0) {
+                break;
+            }
+            out.resize(out.size() * 2);
+        }
+        out.resize(produced);
+    });
+    filtered = std::vector<uint8_t>();
+
+    PngWriteState state;
+    FILE *f = state.f = fopen(filename.c_str(), "wb");
+    _assert(f, "[write_png_file] File %s could not be opened for writing\n", filename.c_str());
+
+    static const uint8_t signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    _assert(fwrite(signature, 1, 8, f) == 8, "[write_png_file] Error during writing header\n");
+
+    uint8_t ihdr[13] = {(uint8_t) (width >> 24), (uint8_t) (width >> 16), (uint8_t) (width >> 8), (uint8_t) width,
+                        (uint8_t) (height >> 24), (uint8_t) (height >> 16), (uint8_t) (height >> 8), (uint8_t) height,
+                        (uint8_t) bit_depth, color_type, 0, 0, 0};
+    png_write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+
+    // The zlib header: deflate with a 32 KB window, the level hint, and the
+    // check bits that make it a multiple of 31.
+    int level = options.level < 0 ? 6 : options.level;
+    uint8_t cmf = 0x78;
+    uint8_t flg = (uint8_t) ((level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6);
+    flg |= 31 - (cmf * 256 + flg) % 31;
+    deflated[0].insert(deflated[0].begin(), {cmf, flg});
+
+    uLong adler = adlers[0];
+    for (int k = 1; k < strips; k++) {
+        size_t length = filtered_bytes * (std::min(height, (k + 1) * strip_rows) - k * strip_rows);
+        adler = adler32_combine(adler, adlers[k], (z_off_t) length);
+    }
+    deflated.back().insert(deflated.back().end(),
+                           {(uint8_t) (adler >> 24), (uint8_t) (adler >> 16), (uint8_t) (adler >> 8), (uint8_t) adler});
+
+    for (const std::vector<uint8_t> &strip : deflated) {
+        png_write_chunk(f, "IDAT", strip.data(), strip.size());
+    }
+    png_write_chunk(f, "IEND", nullptr, 0);
 }
 
 template<typename T>
-void save_png(Buffer<T> im, std::string filename) {
-    png_structp png_ptr;
-    png_infop info_ptr;
-    png_bytep *row_pointers;
+void save_png(Buffer<T> im, std::string filename, const PngOptions &options = PngOptions()) {
     png_byte color_type;
 
     im.copy_to_host();
@@ -184,24 +630,43 @@ void save_png(Buffer<T> im, std::string filename) {
                               };
     color_type = color_types[im.channels() - 1];
 
+    unsigned int bit_depth = 16;
+    if (sizeof(T) == 1) {
+        bit_depth = 8;
+    }
+
+    if (options.threads != 1 || options.strip_rows > 0) {
+        save_png_strips(im, filename, options, bit_depth, color_type);
+        return;
+    }
+
     // open file
-    FILE *f = fopen(filename.c_str(), "wb");
+    PngWriteState state;
+    FILE *f = state.f = fopen(filename.c_str(), "wb");
     _assert(f, "[write_png_file] File %s could not be opened for writing\n", filename.c_str());
 
     // initialize stuff
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_structp png_ptr = state.png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     _assert(png_ptr, "[write_png_file] png_create_write_struct failed\n");
 
-    info_ptr = png_create_info_struct(png_ptr);
+    png_infop info_ptr = state.info_ptr = png_create_info_struct(png_ptr);
     _assert(info_ptr, "[write_png_file] png_create_info_struct failed\n");
 
+    // Everything libpng's error handler jumps over is constructed before the
+    // setjmp, so nothing is skipped on the way back.
+    std::vector<png_byte> rows;
+    std::vector<png_bytep> row_pointers;
+
     _assert(!setjmp(png_jmpbuf(png_ptr)), "[write_png_file] Error during init_io\n");
 
     png_init_io(png_ptr, f);
 
-    unsigned int bit_depth = 16;
-    if (sizeof(T) == 1) {
-        bit_depth = 8;
+    if (options.level >= 0) {
+        png_set_compression_level(png_ptr, options.level);
+    }
+    if (options.filter != PngFilter::Adaptive) {
+        static const int filters[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH};
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters[(int) options.filter - (int) PngFilter::None]);
     }
 
     // write header
@@ -213,122 +678,377 @@ void save_png(Buffer<T> im, std::string filename) {
 
     png_write_info(png_ptr, info_ptr);
 
-    row_pointers = new png_bytep[im.height()];
-
-    // im.copyToHost(); // in case the image is on the gpu
-
-    int c_stride = (im.channels() == 1) ? 0 : im.stride(2);
-    T *srcPtr = (T*)im.data();
-
+    size_t row_bytes = png_get_rowbytes(png_ptr, info_ptr);
+    rows.resize(row_bytes * im.height());
+    row_pointers.resize(im.height());
     for (int y = 0; y < im.height(); y++) {
-        row_pointers[y] = new png_byte[png_get_rowbytes(png_ptr, info_ptr)];
-        uint8_t *dstPtr = (uint8_t *)(row_pointers[y]);
-        if (bit_depth == 16) {
-            // convert to uint16_t
-            for (int x = 0; x < im.width(); x++) {
-                for (int c = 0; c < im.channels(); c++) {
-                    uint16_t out;
-                    convert(srcPtr[c*c_stride], out);
-                    *dstPtr++ = out >> 8;
-                    *dstPtr++ = out & 0xff;
-                }
-                srcPtr++;
-            }
-        } else if (bit_depth == 8) {
-            // convert to uint8_t
-            for (int x = 0; x < im.width(); x++) {
-                for (int c = 0; c < im.channels(); c++) {
-                    uint8_t out;
-                    convert(srcPtr[c*c_stride], out);
-                    *dstPtr++ = out;
-                }
-                srcPtr++;
-            }
-        } else {
-            _assert(bit_depth == 8 || bit_depth == 16, "We only support saving 8- and 16-bit images.");
-        }
+        row_pointers[y] = &rows[row_bytes * y];
+        png_encode_row(im, y, bit_depth, (uint8_t *) row_pointers[y]);
     }
 
     // write data
     _assert(!setjmp(png_jmpbuf(png_ptr)), "[write_png_file] Error during writing bytes");
 
-    png_write_image(png_ptr, row_pointers);
+    png_write_image(png_ptr, row_pointers.data());
 
     // finish write
     _assert(!setjmp(png_jmpbuf(png_ptr)), "[write_png_file] Error during end of write");
 
     png_write_end(png_ptr, NULL);
+}
 
-    // clean up
-    for (int y = 0; y < im.height(); y++) {
-        delete[] row_pointers[y];
+
+
+// Libjpeg's error manager, but jumping back to the decoder with the message
+// rather than exiting.
+struct JpegErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+
+    static void error_exit(j_common_ptr cinfo) {
+        JpegErrorManager *err = (JpegErrorManager *) cinfo->err;
+        (*cinfo->err->format_message)(cinfo, err->message);
+        longjmp(err->jump, 1);
+    }
+};
+
+/**
+ * Load a JPEG file, decoding a few scanlines at a time straight into the
+ * planar buffer. scale_denom 2, 4 or 8 has libjpeg decode at 1/2, 1/4 or 1/8
+ * of the resolution in the DCT domain (scale_num / scale_denom), so the
+ * full-resolution pixels are never produced: the image is
+ * ceil(width / scale_denom) x ceil(height / scale_denom). Corrupt files
+ * throw an ImageIOError with libjpeg's message.
+ */
+template<typename T>
+Buffer<T> load_jpeg(std::string filename, int scale_denom = 1) {
+    _assert(scale_denom == 1 || scale_denom == 2 || scale_denom == 4 || scale_denom == 8,
+            "JPEG files can only be decoded at 1/1, 1/2, 1/4 or 1/8 scale\n");
+
+    FILE *f = fopen(filename.c_str(), "rb");
+    _assert(f, "File %s could not be opened for reading\n", filename.c_str());
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = JpegErrorManager::error_exit;
+
+    // Everything the error handler jumps over is constructed before the
+    // setjmp, so nothing is skipped on the way back.
+    Buffer<T> im(1);
+    std::vector<JSAMPLE> rows;
+    std::vector<JSAMPROW> row_pointers;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(f);
+        throw ImageIOError(image_io_message("Error reading JPEG file %s: %s\n", filename.c_str(), jerr.message));
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, f);
+    jpeg_read_header(&cinfo, TRUE);
+
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(f);
+        _assert(false, "Can't read CMYK JPEG file %s\n", filename.c_str());
     }
-    delete[] row_pointers;
+    cinfo.out_color_space = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale_denom;
+    jpeg_start_decompress(&cinfo);
+
+    int width = cinfo.output_width;
+    int height = cinfo.output_height;
+    int channels = cinfo.output_components;
 
+    if (channels != 1) {
+        im = Buffer<T>(width, height, channels);
+    } else {
+        im = Buffer<T>(width, height);
+    }
+
+    int c_stride = (im.channels() == 1) ? 0 : im.stride(2);
+    size_t row_bytes = (size_t) width * channels;
+
+    // As many rows as libjpeg decodes at once, reused for the whole image.
+    int block = std::max(1, cinfo.rec_outbuf_height);
+    rows.resize(row_bytes * block);
+    row_pointers.resize(block);
+    for (int i = 0; i < block; i++) {
+        row_pointers[i] = &rows[row_bytes * i];
+    }
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        int y = cinfo.output_scanline;
+        int n = jpeg_read_scanlines(&cinfo, row_pointers.data(), block);
+        for (int i = 0; i < n; i++) {
+            T *dst = (T *) im.data() + (size_t) (y + i) * im.stride(1);
+            if constexpr (std::is_same<T, float>::value) {
+                PixelConvert::deinterleave(row_pointers[i], dst, width, channels, c_stride);
+            } else {
+                convert_png_row(row_pointers[i], dst, c_stride, width, channels);
+            }
+        }
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
     fclose(f);
 
-    png_destroy_write_struct(&png_ptr, &info_ptr);
+    im.set_host_dirty();
+    return im;
 }
 
+/**
+ * Save a one- or three-channel image as a baseline JPEG of the given
+ * quality (0 to 100).
+ */
+template<typename T>
+void save_jpeg(Buffer<T> im, std::string filename, int quality = 90) {
+    im.copy_to_host();
 
+    _assert(im.channels() == 1 || im.channels() == 3, "Can only write JPEG files with 1 or 3 channels\n");
 
-inline int is_little_endian() {
-    int value = 1;
-    return ((char *) &value)[0] == 1;
+    FILE *f = fopen(filename.c_str(), "wb");
+    _assert(f, "[write_jpeg_file] File %s could not be opened for writing\n", filename.c_str());
+
+    jpeg_compress_struct cinfo;
+    JpegErrorManager jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = JpegErrorManager::error_exit;
+
+    std::vector<JSAMPLE> row;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        fclose(f);
+        throw ImageIOError(image_io_message("Error writing JPEG file %s: %s\n", filename.c_str(), jerr.message));
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+
+    cinfo.image_width = im.width();
+    cinfo.image_height = im.height();
+    cinfo.input_components = im.channels();
+    cinfo.in_color_space = im.channels() == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    // Rows are interleaved and converted to 8 bits like those of an 8-bit PNG.
+    row.resize((size_t) im.width() * im.channels());
+    JSAMPROW row_pointer = row.data();
+    for (int y = 0; y < im.height(); y++) {
+        png_encode_row(im, y, 8, row.data());
+        jpeg_write_scanlines(&cinfo, &row_pointer, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(f);
 }
 
 #define SWAP_ENDIAN16(little_endian, value) if (little_endian) { (value) = (((value) & 0xff)<<8)|(((value) & 0xff00)>>8); }
 
+/**
+ * A whole file mapped into memory: read-only to load it, or created with
+ * its final size to save it, so samples are converted straight from or to
+ * the file's pages without a temporary copy of the image. Where mmap isn't
+ * available, the file goes through a heap buffer instead.
+ */
+class MappedFile {
+public:
+    // Maps filename for reading.
+    explicit MappedFile(const std::string &filename) : writable(false) {
+#ifdef IMAGE_IO_MMAP
+        fd = open(filename.c_str(), O_RDONLY);
+        _assert(fd >= 0, "File %s could not be opened for reading\n", filename.c_str());
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+        length = ok ? (size_t) st.st_size : 0;
+        // Private, so writes through data() are copy-on-write and never
+        // reach the file.
+        bytes = ok ? (uint8_t *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : (uint8_t *) MAP_FAILED;
+        if (bytes == MAP_FAILED) {
+            ::close(fd);
+        }
+        _assert(ok, "File %s is empty\n", filename.c_str());
+        _assert(bytes != MAP_FAILED, "File %s could not be mapped\n", filename.c_str());
+#else
+        FILE *f = fopen(filename.c_str(), "rb");
+        _assert(f, "File %s could not be opened for reading\n", filename.c_str());
+        fseek(f, 0, SEEK_END);
+        length = (size_t) ftell(f);
+        fseek(f, 0, SEEK_SET);
+        buffer.resize(length);
+        _assert(fread(buffer.data(), 1, length, f) == length, "Could not read %s\n", filename.c_str());
+        fclose(f);
+        bytes = buffer.data();
+#endif
+    }
+
+    // Creates filename with size bytes, written by close().
+    MappedFile(const std::string &filename, size_t size) : writable(true), length(size), path(filename) {
+        _assert(size > 0, "Can't write an empty file %s\n", filename.c_str());
+#ifdef IMAGE_IO_MMAP
+        fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        _assert(fd >= 0, "File %s could not be opened for writing\n", filename.c_str());
+        bool resized = ftruncate(fd, (off_t) length) == 0;
+        bytes = resized ? (uint8_t *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : (uint8_t *) MAP_FAILED;
+        if (bytes == MAP_FAILED) {
+            ::close(fd);
+        }
+        _assert(resized, "File %s could not be resized\n", filename.c_str());
+        _assert(bytes != MAP_FAILED, "File %s could not be mapped\n", filename.c_str());
+#else
+        buffer.resize(length);
+        bytes = buffer.data();
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Writes a file created for writing and releases it, throwing if that
+    // fails. A file being read needn't be closed.
+    void close() {
+        if (closed) {
+            return;
+        }
+        closed = true;
+#ifdef IMAGE_IO_MMAP
+        bool unmapped = munmap(bytes, length) == 0;
+        bool written = ::close(fd) == 0 && unmapped;
+        _assert(!writable || written, "Could not write %s\n", path.c_str());
+#else
+        if (writable) {
+            FILE *f = fopen(path.c_str(), "wb");
+            _assert(f, "File %s could not be opened for writing\n", path.c_str());
+            bool written = fwrite(bytes, 1, length, f) == length;
+            written = fclose(f) == 0 && written;
+            _assert(written, "Could not write %s\n", path.c_str());
+        }
+#endif
+    }
+
+    // Releases the file without throwing. A file created for writing that
+    // wasn't closed, e.g. because its save threw, is left incomplete.
+    ~MappedFile() {
+        if (closed) {
+            return;
+        }
+#ifdef IMAGE_IO_MMAP
+        munmap(bytes, length);
+        ::close(fd);
+#endif
+    }
+
+    uint8_t *data() { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    bool writable;
+    bool closed = false;
+    uint8_t *bytes = nullptr;
+    size_t length = 0;
+    std::string path;
+#ifdef IMAGE_IO_MMAP
+    int fd = -1;
+#else
+    std::vector<uint8_t> buffer;
+#endif
+};
+
+/**
+ * Parse the header of a binary netpbm-style file (PPM or PFM) at data:
+ * magic, width, height and a last number (maxval or scale), skipping
+ * comments, and return the offset of the samples.
+ */
+inline size_t parse_pnm_header(const uint8_t *data, size_t size, std::string &magic,
+                               int &width, int &height, double &last) {
+    size_t i = 0;
+    auto skip_space = [&]() {
+        while (i < size && (isspace(data[i]) || data[i] == '#')) {
+            if (data[i] == '#') {
+                while (i < size && data[i] != '\n') { i++; }
+            } else {
+                i++;
+            }
+        }
+    };
+    auto token = [&]() {
+        skip_space();
+        std::string t;
+        while (i < size && !isspace(data[i])) { t += (char) data[i++]; }
+        _assert(!t.empty(), "Could not read PPM header\n");
+        return t;
+    };
+
+    magic = token();
+    width = atoi(token().c_str());
+    height = atoi(token().c_str());
+    last = atof(token().c_str());
+    // A single whitespace character separates the header from the samples.
+    _assert(i < size, "File ended before end of header\n");
+    return i + 1;
+}
+
 template<typename T>
 Buffer<T> load_ppm(std::string filename) {
+    MappedFile file(filename);
 
-    /* open file and test for it being a ppm */
-    FILE *f = fopen(filename.c_str(), "rb");
-    _assert(f, "File %s could not be opened for reading\n", filename.c_str());
+    int width, height;
+    double maxval;
+    std::string header;
+    size_t offset = parse_pnm_header(file.data(), file.size(), header, width, height, maxval);
 
-    int width, height, maxval;
-    char header[256];
-    _assert(fscanf(f, "%255s", header) == 1, "Could not read PPM header\n");
-    _assert(fscanf(f, "%d %d\n", &width, &height) == 2, "Could not read PPM width and height\n");
-    _assert(fscanf(f, "%d", &maxval) == 1, "Could not read PPM max value\n");
-    _assert(fgetc(f) != EOF, "Could not read char from PPM\n");
+    _assert(header == "P6" || header == "p6", "Input is not binary PPM\n");
 
     int bit_depth = 0;
     if (maxval == 255) { bit_depth = 8; }
     else if (maxval == 65535) { bit_depth = 16; }
     else { _assert(false, "Invalid bit depth in PPM\n"); }
 
-    _assert(strcmp(header, "P6") == 0 || strcmp(header, "p6") == 0, "Input is not binary PPM\n");
-
     int channels = 3;
+    size_t row_bytes = (size_t) width * channels * (bit_depth / 8);
+    _assert(file.size() >= offset + row_bytes * height, "Could not read PPM %d-bit data\n", bit_depth);
+
     Buffer<T> im(width, height, channels);
 
-    // convert the data to T
+    // convert the data to T, straight from the mapped file
+    T *im_data = (T*) im.data();
+    const uint8_t *data = file.data() + offset;
     if (bit_depth == 8) {
-        uint8_t *data = new uint8_t[width*height*3];
-        _assert(fread((void *) data,
-                      sizeof(uint8_t), width*height*3, f) == (size_t) (width*height*3),
-                "Could not read PPM 8-bit data\n");
-        fclose(f);
-
-        T *im_data = (T*) im.data();
         for (int y = 0; y < im.height(); y++) {
-            uint8_t *row = (uint8_t *)(&data[(y*width)*3]);
+            const uint8_t *row = &data[row_bytes * y];
+            if constexpr (std::is_same<T, float>::value) {
+                PixelConvert::deinterleave(row, &im_data[y*width], width, 3, (ptrdiff_t) width*height);
+                continue;
+            }
             for (int x = 0; x < im.width(); x++) {
                 convert(*row++, im_data[(0*height+y)*width+x]);
                 convert(*row++, im_data[(1*height+y)*width+x]);
                 convert(*row++, im_data[(2*height+y)*width+x]);
             }
         }
-        delete[] data;
     } else if (bit_depth == 16) {
         int little_endian = is_little_endian();
-        uint16_t *data = new uint16_t[width*height*3];
-        _assert(fread((void *) data, sizeof(uint16_t), width*height*3, f) == (size_t) (width*height*3), "Could not read PPM 16-bit data\n");
-        fclose(f);
-        T *im_data = (T*) im.data();
+        // The header can leave the samples unaligned; such rows are copied
+        // to an aligned scratch row first.
+        bool aligned = ((uintptr_t) data % alignof(uint16_t)) == 0;
+        std::vector<uint16_t> scratch(aligned ? 0 : (size_t) width * channels);
         for (int y = 0; y < im.height(); y++) {
-            uint16_t *row = (uint16_t *) (&data[(y*width)*3]);
+            const uint16_t *row = (const uint16_t *) &data[row_bytes * y];
+            if (!aligned) {
+                memcpy(scratch.data(), &data[row_bytes * y], row_bytes);
+                row = scratch.data();
+            }
+            if constexpr (std::is_same<T, float>::value) {
+                PixelConvert::deinterleave(row, &im_data[y*width], width, 3, (ptrdiff_t) width*height, little_endian);
+                continue;
+            }
             for (int x = 0; x < im.width(); x++) {
                 uint16_t value;
                 value = *row++; SWAP_ENDIAN16(little_endian, value); convert(value, im_data[(0*height+y)*width+x]);
@@ -336,7 +1056,6 @@ Buffer<T> load_ppm(std::string filename) {
                 value = *row++; SWAP_ENDIAN16(little_endian, value); convert(value, im_data[(2*height+y)*width+x]);
             }
         }
-        delete[] data;
     }
     im(0,0,0) = im(0,0,0);      /* Mark dirty inside read/write functions. */
 
@@ -346,66 +1065,492 @@ Buffer<T> load_ppm(std::string filename) {
 template<typename T>
 void save_ppm(Buffer<T> im, std::string filename) {
     unsigned int bit_depth = sizeof(T) == 1 ? 8: 16;
-
-    FILE *f = fopen(filename.c_str(), "wb");
-    _assert(f, "File %s could not be opened for writing\n", filename.c_str());
-    fprintf(f, "P6\n%d %d\n%d\n", im.width(), im.height(), (1<<bit_depth)-1);
     int width = im.width(), height = im.height();
 
+    char header[64];
+    int header_bytes = snprintf(header, sizeof(header), "P6\n%d %d\n%d\n", width, height, (1<<bit_depth)-1);
+    size_t row_bytes = (size_t) width * 3 * (bit_depth / 8);
+
+    // convert the data straight into the mapped file
+    MappedFile file(filename, header_bytes + row_bytes * height);
+    memcpy(file.data(), header, header_bytes);
+    uint8_t *data = file.data() + header_bytes;
+
     if (bit_depth == 8) {
-        uint8_t *data = new uint8_t[width*height*3];
         for (int y = 0; y < im.height(); y++) {
+            if constexpr (std::is_same<T, float>::value) {
+                if (im.channels() == 3) {
+                    PixelConvert::interleave(&im(0, y, 0), im.stride(2), &data[row_bytes * y], width, 3);
+                    continue;
+                }
+            }
             for (int x = 0; x < im.width(); x++) {
-                uint8_t *p = (uint8_t *)(&data[(y*width+x)*3]);
+                uint8_t *p = (uint8_t *)(&data[row_bytes * y + x*3]);
                 for (int c = 0; c < im.channels(); c++) {
                     convert(im(x, y, c), p[c]);
                 }
             }
         }
-        _assert(fwrite((void *) data, sizeof(uint8_t), width*height*3, f) == (size_t) (width*height*3), "Could not write PPM 8-bit data\n");
-        delete[] data;
     } else if (bit_depth == 16) {
         int little_endian = is_little_endian();
-        uint16_t *data = new uint16_t[width*height*3];
+        // Rows are converted into an aligned scratch row when the header
+        // leaves the samples unaligned.
+        bool aligned = ((uintptr_t) data % alignof(uint16_t)) == 0;
+        std::vector<uint16_t> scratch(aligned ? 0 : (size_t) width * 3);
         for (int y = 0; y < im.height(); y++) {
-            for (int x = 0; x < im.width(); x++) {
-                uint16_t *p = (uint16_t *)(&data[(y*width+x)*3]);
-                for (int c = 0; c < im.channels(); c++) {
-                    uint16_t value;
-                    convert(im(x, y, c), value);
-                    SWAP_ENDIAN16(little_endian, value);
-                    p[c] = value;
+            uint16_t *row = aligned ? (uint16_t *) &data[row_bytes * y] : scratch.data();
+            bool converted = false;
+            if constexpr (std::is_same<T, float>::value) {
+                if (im.channels() == 3) {
+                    PixelConvert::interleave(&im(0, y, 0), im.stride(2), row, width, 3, little_endian);
+                    converted = true;
+                }
+            }
+            if (!converted) {
+                for (int x = 0; x < im.width(); x++) {
+                    uint16_t *p = &row[x*3];
+                    for (int c = 0; c < im.channels(); c++) {
+                        uint16_t value;
+                        convert(im(x, y, c), value);
+                        SWAP_ENDIAN16(little_endian, value);
+                        p[c] = value;
+                    }
                 }
             }
+            if (!aligned) {
+                memcpy(&data[row_bytes * y], row, row_bytes);
+            }
         }
-        _assert(fwrite((void *) data, sizeof(uint16_t), width*height*3, f) == (size_t) (width*height*3), "Could not write PPM 16-bit data\n");
-        delete[] data;
     }
+    file.close();
+}
+
+/**
+ * Load a PFM file: 32-bit float samples, three channels ("PF") or one
+ * ("Pf"), rows stored bottom to top, little-endian if the scale in the
+ * header is negative.
+ */
+template<typename T>
+Buffer<T> load_pfm(std::string filename) {
+    MappedFile file(filename);
+
+    int width, height;
+    double scale;
+    std::string header;
+    size_t offset = parse_pnm_header(file.data(), file.size(), header, width, height, scale);
+
+    _assert(header == "PF" || header == "Pf", "Input is not a PFM file\n");
+    int channels = header == "PF" ? 3 : 1;
+    bool swap = (scale < 0) != (bool) is_little_endian();
+
+    size_t row_samples = (size_t) width * channels;
+    _assert(file.size() >= offset + row_samples * sizeof(float) * height, "Could not read PFM data\n");
+
+    Buffer<T> im(1);
+    if (channels != 1) {
+        im = Buffer<T>(width, height, channels);
+    } else {
+        im = Buffer<T>(width, height);
+    }
+
+    int c_stride = (channels == 1) ? 0 : im.stride(2);
+    T *im_data = (T*) im.data();
+    const uint8_t *data = file.data() + offset;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = &data[row_samples * sizeof(float) * (height - 1 - y)];
+        T *dst = &im_data[(size_t) y * im.stride(1)];
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                uint32_t bits;
+                memcpy(&bits, &row[(x * channels + c) * sizeof(float)], sizeof(bits));
+                if (swap) {
+                    bits = __builtin_bswap32(bits);
+                }
+                float value;
+                memcpy(&value, &bits, sizeof(value));
+                convert(value, dst[c * c_stride + x]);
+            }
+        }
+    }
+    im.set_host_dirty();
+
+    return im;
+}
+
+/**
+ * Save a one- or three-channel image as a little-endian PFM file.
+ */
+template<typename T>
+void save_pfm(Buffer<T> im, std::string filename) {
+    _assert(im.channels() == 1 || im.channels() == 3, "Can only write PFM files with 1 or 3 channels\n");
+    int width = im.width(), height = im.height(), channels = im.channels();
+
+    char header[64];
+    int header_bytes = snprintf(header, sizeof(header), "%s\n%d %d\n%s\n",
+                                channels == 3 ? "PF" : "Pf", width, height, is_little_endian() ? "-1.0" : "1.0");
+    size_t row_samples = (size_t) width * channels;
+
+    MappedFile file(filename, header_bytes + row_samples * sizeof(float) * height);
+    memcpy(file.data(), header, header_bytes);
+    uint8_t *data = file.data() + header_bytes;
+
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = &data[row_samples * sizeof(float) * (height - 1 - y)];
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                float value;
+                convert(im.dimensions() > 2 ? im(x, y, c) : im(x, y), value);
+                memcpy(&row[(x * channels + c) * sizeof(float)], &value, sizeof(value));
+            }
+        }
+    }
+    file.close();
+}
+
+/**
+ * Header of a raw dump (.raw): samples of any type and 1 to 4 dimensions,
+ * uncompressed, at data_offset. Meant for intermediates that must be saved
+ * exactly and fast, not for interchange: samples are in the byte order of
+ * the machine that wrote them.
+ */
+struct RawHeader {
+    char magic[4];          // "HRAW"
+    uint8_t type_code;      // halide_type_code_t: int, uint or float
+    uint8_t type_bits;
+    uint8_t dimensions;
+    uint8_t little_endian;
+    int32_t min[4];
+    int32_t extent[4];
+    int64_t stride[4];      // In samples, of the data in the file.
+    uint64_t data_offset;   // From the start of the file.
+};
+
+// Samples start at a multiple of the cache line size, for aligned loads from
+// a mapping.
+const size_t raw_data_offset = 128;
+
+// One sample of a raw dump of type type, converted to T.
+template<typename T>
+inline void convert_raw_sample(const uint8_t *src, halide_type_t type, T &out) {
+    if (type == halide_type_of<float>()) {
+        float value;
+        memcpy(&value, src, sizeof(value));
+        convert(value, out);
+    } else if (type == halide_type_of<uint8_t>()) {
+        convert(*src, out);
+    } else if (type == halide_type_of<uint16_t>()) {
+        uint16_t value;
+        memcpy(&value, src, sizeof(value));
+        convert(value, out);
+    } else {
+        _assert(false, "Can only convert float, uint8 and uint16 raw dumps\n");
+    }
+}
+
+// The checked header of a raw dump in file: the type and shape of its
+// samples, and where they are.
+struct RawLayout {
+    halide_type_t type;
+    int dims = 0;
+    std::vector<int> sizes, mins;
+    int64_t stride[4] = {0, 0, 0, 0};
+    bool dense = true;
+    uint8_t *data = nullptr;
+};
+
+inline RawLayout parse_raw(MappedFile &file, const std::string &filename) {
+    RawHeader header;
+    _assert(file.size() >= sizeof(header), "File ended before end of header\n");
+    memcpy(&header, file.data(), sizeof(header));
+    _assert(memcmp(header.magic, "HRAW", 4) == 0, "Input is not a raw dump\n");
+    _assert(header.dimensions >= 1 && header.dimensions <= 4, "Invalid dimensions in raw dump\n");
+    _assert((int) header.little_endian == is_little_endian(), "Raw dump %s has the other byte order\n", filename.c_str());
+
+    RawLayout layout;
+    layout.type = halide_type_t((halide_type_code_t) header.type_code, header.type_bits);
+    layout.dims = header.dimensions;
+    int64_t last = 0, dense_stride = 1;
+    for (int d = 0; d < layout.dims; d++) {
+        _assert(header.extent[d] > 0 && header.stride[d] >= 0, "Invalid shape in raw dump\n");
+        layout.sizes.push_back(header.extent[d]);
+        layout.mins.push_back(header.min[d]);
+        layout.stride[d] = header.stride[d];
+        layout.dense = layout.dense && header.stride[d] == dense_stride;
+        dense_stride *= header.extent[d];
+        last += (int64_t) (header.extent[d] - 1) * header.stride[d];
+    }
+    _assert(file.size() >= header.data_offset + (size_t) (last + 1) * layout.type.bytes(), "Could not read raw dump data\n");
+    layout.data = file.data() + header.data_offset;
+    return layout;
+}
+
+/**
+ * Load a raw dump through a mapping of the file into a new buffer.
+ * Buffer<void> (Buffer<>) takes the type of the file; other types convert
+ * float, uint8 and uint16 samples like the other loaders. map_raw loads a
+ * dump of the buffer's type without copying it.
+ */
+template<typename T>
+Buffer<T> load_raw(std::string filename) {
+    MappedFile file(filename);
+    RawLayout layout = parse_raw(file, filename);
+    halide_type_t type = layout.type;
+    const uint8_t *data = layout.data;
+
+    bool same_type = true;
+    if constexpr (!std::is_void<T>::value) {
+        same_type = halide_type_of<T>() == type;
+    }
+
+    Buffer<T> im;
+    if constexpr (std::is_void<T>::value) {
+        im = Buffer<T>(type, layout.sizes);
+    } else {
+        im = Buffer<T>(layout.sizes);
+    }
+    im.translate(layout.mins);
+
+    if (same_type && layout.dense) {
+        memcpy(im.data(), data, im.size_in_bytes());
+    } else {
+        // Walk the rows of the buffer, reading them wherever the strides of
+        // the file put them.
+        int extent[4] = {1, 1, 1, 1};
+        int64_t src_stride[4] = {0, 0, 0, 0}, dst_stride[4] = {0, 0, 0, 0};
+        for (int d = 0; d < layout.dims; d++) {
+            extent[d] = layout.sizes[d];
+            src_stride[d] = layout.stride[d] * type.bytes();
+            dst_stride[d] = im.dim(d).stride() * im.type().bytes();
+        }
+        uint8_t *im_data = (uint8_t *) im.data();
+        for (int w = 0; w < extent[3]; w++) {
+            for (int z = 0; z < extent[2]; z++) {
+                for (int y = 0; y < extent[1]; y++) {
+                    const uint8_t *src = data + y * src_stride[1] + z * src_stride[2] + w * src_stride[3];
+                    uint8_t *dst = im_data + y * dst_stride[1] + z * dst_stride[2] + w * dst_stride[3];
+                    if (same_type && src_stride[0] == type.bytes()) {
+                        memcpy(dst, src, (size_t) extent[0] * type.bytes());
+                    } else if (same_type) {
+                        for (int x = 0; x < extent[0]; x++) {
+                            memcpy(dst + x * dst_stride[0], src + x * src_stride[0], type.bytes());
+                        }
+                    } else if constexpr (!std::is_void<T>::value) {
+                        for (int x = 0; x < extent[0]; x++) {
+                            convert_raw_sample(src + x * src_stride[0], type, *(T *) (dst + x * dst_stride[0]));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    im.set_host_dirty();
+
+    return im;
+}
+
+/**
+ * A raw dump loaded in place by map_raw. buffer views the samples of a
+ * private, copy-on-write mapping of the file, which file keeps alive: keep
+ * the MappedRaw (or a copy of it) for as long as buffer is used.
+ */
+template<typename T>
+struct MappedRaw {
+    std::shared_ptr<MappedFile> file;
+    Buffer<T> buffer;
+};
+
+/**
+ * Load a raw dump without copying it, when its samples are of the buffer's
+ * type (any type for Buffer<void>), planar and dense. Other dumps are loaded
+ * by load_raw, into a buffer of their own, and file is left empty.
+ */
+template<typename T>
+MappedRaw<T> map_raw(std::string filename) {
+    MappedRaw<T> mapped;
+    mapped.file = std::make_shared<MappedFile>(filename);
+    RawLayout layout = parse_raw(*mapped.file, filename);
+
+    bool same_type = true;
+    if constexpr (!std::is_void<T>::value) {
+        same_type = halide_type_of<T>() == layout.type;
+    }
+    if (!same_type || !layout.dense) {
+        mapped.file = nullptr;
+        mapped.buffer = load_raw<T>(filename);
+        return mapped;
+    }
+
+    if constexpr (std::is_void<T>::value) {
+        mapped.buffer = Buffer<T>(layout.type, layout.data, layout.sizes);
+    } else {
+        mapped.buffer = Buffer<T>((T *) layout.data, layout.sizes);
+    }
+    mapped.buffer.translate(layout.mins);
+    mapped.buffer.set_host_dirty();
+    return mapped;
+}
+
+/**
+ * Save any Buffer, Buffer<void> included, as a raw dump: the header, then the
+ * samples, planar and dense, in one write. Other layouts are copied first.
+ */
+template<typename T>
+void save_raw(Buffer<T> im, std::string filename) {
+    int dims = im.dimensions();
+    _assert(dims >= 1 && dims <= 4, "Can only write raw dumps of 1 to 4 dimensions\n");
+
+    bool dense = true;
+    int64_t stride = 1;
+    std::vector<int> sizes, mins;
+    for (int d = 0; d < dims; d++) {
+        dense = dense && im.dim(d).stride() == stride;
+        stride *= im.dim(d).extent();
+        sizes.push_back(im.dim(d).extent());
+        mins.push_back(im.dim(d).min());
+    }
+    if (!dense) {
+        Buffer<T> planar(im.type(), sizes);
+        planar.translate(mins);
+        planar.copy_from(im);
+        im = planar;
+    }
+
+    uint8_t block[raw_data_offset] = {0};
+    RawHeader header = {};
+    memcpy(header.magic, "HRAW", 4);
+    halide_type_t type = im.type();
+    header.type_code = (uint8_t) type.code;
+    header.type_bits = (uint8_t) type.bits;
+    header.dimensions = (uint8_t) dims;
+    header.little_endian = (uint8_t) is_little_endian();
+    for (int d = 0; d < dims; d++) {
+        header.min[d] = im.dim(d).min();
+        header.extent[d] = im.dim(d).extent();
+        header.stride[d] = im.dim(d).stride();
+    }
+    header.data_offset = raw_data_offset;
+    memcpy(block, &header, sizeof(header));
+
+    size_t bytes = im.size_in_bytes();
+#ifdef IMAGE_IO_MMAP
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    _assert(fd >= 0, "File %s could not be opened for writing\n", filename.c_str());
+    struct iovec iov[2] = {{block, raw_data_offset}, {(void *) im.data(), bytes}};
+    // writev may write less than asked for, e.g. over 2 GB on Linux.
+    int first = 0;
+    while (first < 2) {
+        ssize_t written = writev(fd, iov + first, 2 - first);
+        _assert(written > 0, "Could not write %s\n", filename.c_str());
+        while (first < 2 && (size_t) written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if (first < 2) {
+            iov[first].iov_base = (uint8_t *) iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+    close(fd);
+#else
+    FILE *f = fopen(filename.c_str(), "wb");
+    _assert(f, "File %s could not be opened for writing\n", filename.c_str());
+    _assert(fwrite(block, 1, raw_data_offset, f) == raw_data_offset &&
+            fwrite(im.data(), 1, bytes, f) == bytes, "Could not write %s\n", filename.c_str());
     fclose(f);
+#endif
 }
 
 template<typename T>
 Buffer<T> load(std::string filename) {
     if (ends_with_ignore_case(filename, ".png")) {
         return load_png<T>(filename);
+    } else if (ends_with_ignore_case(filename, ".jpg") || ends_with_ignore_case(filename, ".jpeg")) {
+        return load_jpeg<T>(filename);
     } else if (ends_with_ignore_case(filename, ".ppm")) {
         return load_ppm<T>(filename);
+    } else if (ends_with_ignore_case(filename, ".pfm")) {
+        return load_pfm<T>(filename);
+    } else if (ends_with_ignore_case(filename, ".raw")) {
+        return load_raw<T>(filename);
     } else {
-        _assert(false, "[load] unsupported file extension (png|ppm supported)");
+        _assert(false, "[load] unsupported file extension (png|jpg|ppm|pfm|raw supported)");
     }
 }
 
+/**
+ * Save by extension. png_options trades PNG file size for speed; the other
+ * formats ignore it.
+ */
 template<typename T>
-void save(Buffer<T> im, std::string filename) {
+void save(Buffer<T> im, std::string filename, const PngOptions &png_options = PngOptions()) {
     if (ends_with_ignore_case(filename, ".png")) {
-        save_png<T>(im, filename);
+        save_png<T>(im, filename, png_options);
+    } else if (ends_with_ignore_case(filename, ".jpg") || ends_with_ignore_case(filename, ".jpeg")) {
+        save_jpeg<T>(im, filename);
     } else if (ends_with_ignore_case(filename, ".ppm")) {
         save_ppm<T>(im, filename);
+    } else if (ends_with_ignore_case(filename, ".pfm")) {
+        save_pfm<T>(im, filename);
+    } else if (ends_with_ignore_case(filename, ".raw")) {
+        save_raw<T>(im, filename);
     } else {
-        _assert(false, "[save] unsupported file extension (png|ppm supported)");
+        _assert(false, "[save] unsupported file extension (png|jpg|ppm|pfm|raw supported)");
     }
 }
 
+/**
+ * Load the files of a bracket concurrently, one decode per thread, up to
+ * threads threads (0 uses one per core). The exposures come back in the
+ * order of filenames, ready for Measures::compute_fusion. If decode_ms isn't
+ * null it receives the time each file took to load, in milliseconds.
+ */
+template<typename T>
+std::vector<Buffer<T>> load_bracket(const std::vector<std::string> &filenames,
+                                    std::vector<double> *decode_ms = nullptr, int threads = 0) {
+    std::vector<Buffer<T>> bracket(filenames.size());
+    std::vector<double> times(filenames.size());
+
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, (int) filenames.size());
+
+    // Each worker takes the next file not taken yet. The first error stops
+    // the workers and is rethrown once they are joined.
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    auto worker = [&]() {
+        for (size_t i = next++; i < filenames.size() && !failed; i = next++) {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                bracket[i] = load<T>(filenames[i]);
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = std::current_exception();
+                }
+                return;
+            }
+            times[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
 
+    if (decode_ms) {
+        *decode_ms = times;
+    }
+    return bracket;
+}
 
 #endif
@@ -0,0 +1,48 @@
+#ifndef _JIT_TIMING_H_
+#define _JIT_TIMING_H_
+
+// Timing of JIT-compiled Funcs and Pipelines, for the tutorials. The library
+// and the programs linked without libHalide use timing.h alone.
+
+#include <Halide.h>
+#include "timing.h"
+
+/**
+ * Time the realization of a Func over sizes, one extent per dimension. The
+ * Func is compiled beforehand so compilation isn't timed.
+ */
+inline ProfileStats profile_stats(Halide::Func f, const std::vector<int> &sizes,
+                                  const ProfileOptions &options = ProfileOptions()) {
+    f.compile_jit();
+    return profile_callable([&]() { f.realize(sizes); }, options);
+}
+
+/**
+ * Time the realization of all the outputs of a Pipeline over sizes.
+ */
+inline ProfileStats profile_stats(Halide::Pipeline p, const std::vector<int> &sizes,
+                                  const ProfileOptions &options = ProfileOptions()) {
+    p.compile_jit();
+    return profile_callable([&]() { p.realize(sizes); }, options);
+}
+
+/**
+ * Print the runtime and throughout and return the runtime.
+ */
+inline float profile(Halide::Func myFunc, int w, int h) {
+    ProfileStats stats = profile_stats(myFunc, {w, h});
+    print_profile(stats, float(w*h)/1e6);
+    return float(stats.median_ms);
+}
+
+
+/**
+ * Print the runtime and throughout and return the runtime.
+ */
+inline float profile(Halide::Func myFunc, int w, int h, int c) {
+    ProfileStats stats = profile_stats(myFunc, {w, h, c});
+    print_profile(stats, float(w*h)/1e6);
+    return float(stats.median_ms);
+}
+
+#endif // _JIT_TIMING_H_
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Halide.h>
+#include "measures_schedule.h"
+#include <string>
+#include <vector>
+
+using Halide::Func;
+using Halide::Expr;
+
+namespace Measures {
+
+  // A sample of an image file as a float in [0, 1]: integer samples are
+  // divided by the largest value of their type, float samples pass through.
+  // Pipelines apply it where they read their input, so 8 and 16-bit frames
+  // are never converted to float in memory.
+  Expr unit_float(Expr sample);
+
+  // The Funcs of the weight pipeline. They are returned unscheduled so each
+  // generator can pick its outputs and schedule.
+  struct WeightStages {
+    Func grayscale;
+    Func laplacian;
+    Func contrast;
+    Func saturation;
+    Func exposure;
+    Func weight;
+  };
+
+  // Defines the (x, y) quality measures of an (x, y, c) input that is
+  // already clamped at its borders. suffix is appended to the name of every
+  // stage, so the stages of several exposures can share a pipeline.
+  //
+  // fast_math stays in float, merges the three exposure Gaussians into one
+  // exp and evaluates the weight as an exp of a sum of logs, using Halide's
+  // fast_exp/fast_log approximations.
+  WeightStages define_weight(
+    Func input,
+    Expr c_weight,
+    Expr s_weight,
+    Expr e_weight,
+    bool fast_math = false,
+    const std::string &suffix = ""
+  );
+
+  // The schedule Measures::compute used originally: every stage is computed
+  // at root, which materializes each measure as a full-frame image.
+  void schedule_weight_root(WeightStages &stages);
+
+  // Production schedule: the output is computed in parallel, vectorized
+  // tiles, grayscale is computed per tile for the laplacian stencil, and the
+  // pointwise measures are inlined into the weight.
+  void schedule_weight_tiled(WeightStages &stages, Func output);
+
+  // Schedule for realizing several stages as outputs of one pipeline. Every
+  // output is computed once in parallel, vectorized tiles and later outputs
+  // read it back instead of recomputing it. grayscale must not be one of
+  // outputs (the laplacian reads it past the image border): realize a
+  // wrapper of it instead and set grayscale_output.
+  void schedule_weight_outputs(WeightStages &stages, const std::vector<Func> &outputs, bool grayscale_output);
+
+  struct BracketStages {
+    std::vector<WeightStages> measures;
+    Func sum_weights;
+    Func normalize_weights;
+    Func normalized;
+  };
+
+  // Defines the normalized weight maps (x, y, n) of a bracket whose
+  // exposures are separate inputs, each clamped like define_weight's, for n
+  // in [0, inputs.size()).
+  BracketStages define_bracket(
+    const std::vector<Func> &inputs,
+    Expr c_weight,
+    Expr s_weight,
+    Expr e_weight,
+    bool fast_math = false
+  );
+
+  // Computes tiles of the normalized weights with the exposures innermost,
+  // so the raw weights of every exposure, their sum and the normalization of
+  // a tile share one pass.
+  void schedule_bracket(BracketStages &stages, Func output);
+
+  // The contrast, saturation and exposure of define_weight's stages as logs,
+  // (x, y, m) for m = 0, 1, 2, clamped away from zero like the fast-math
+  // weight. A weight is then the exp of their dot product with the
+  // exponents, which is all that changes when only the exponents do.
+  Func define_log_measures(const WeightStages &stages);
+
+  // Computes the log measures in parallel, vectorized tiles like
+  // schedule_weight_tiled.
+  void schedule_log_measures(WeightStages &stages, Func output);
+
+  struct RetuneStages {
+    Func weight;
+    Func sum_weights;
+    Func normalize_weights;
+    Func normalized;
+  };
+
+  // Defines the normalized weight maps (x, y, n) of a bracket from its log
+  // measures (x, y, m, n), as given by define_log_measures for each of its
+  // exposures. frames is the number of exposures.
+  RetuneStages define_retune(
+    Func log_measures,
+    Expr frames,
+    Expr c_weight,
+    Expr s_weight,
+    Expr e_weight
+  );
+
+  // Computes tiles of output, either the normalized weights or blend, the
+  // define_blend of the exposures with them, in one pass: the raw weights,
+  // their sum and the normalization of a tile are computed with the
+  // exposures innermost while the tile is in cache.
+  void schedule_retune(RetuneStages &stages, Func output, Func blend = Func());
+
+  // Defines the blend of a stack of frames (x, y, c, n) with weight maps
+  // (x, y, n) that are already normalized.
+  Func define_blend(
+    Func in,
+    Func normalized,
+    Expr frames
+  );
+
+} // namespace Measures
@@ -0,0 +1,20 @@
+#pragma once
+
+namespace Measures {
+
+  // How far past an output region define_weight reads its input: the
+  // laplacian is a 3x3 stencil.
+  const int weight_halo = 1;
+
+  // Tile size of every tiled schedule of the weights: schedule_weight_tiled,
+  // schedule_weight_outputs, schedule_bracket, schedule_retune and
+  // measures_normalize_weights.
+  // compute_fusion_streaming cuts strips of whole tiles.
+  const int weight_tile_width = 256;
+  const int weight_tile_height = 32;
+
+  // measures_bracket is built for brackets of 1 to bracket_max_frames
+  // exposures, each one its own input.
+  const int bracket_max_frames = 8;
+
+} // namespace Measures
@@ -0,0 +1,383 @@
+#pragma once
+
+// Conversion of rows of interleaved 8- and 16-bit samples, as stored in
+// image files, to and from planar float, as stored in a Buffer<float>.
+//
+// The kernels are vectorized with SSE4.1 and AVX2 and picked at runtime by
+// the CPU they run on, so the library needs no -march flag; elsewhere they
+// fall back to scalar code. Every path gives the same results as the scalar
+// one: samples load as s / 255.0f (or 65535.0f) and store as the truncation
+// of v * 255.0f (or 65535.0f), saturated to the range of the type.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PIXEL_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace PixelConvert {
+
+  enum class Isa {
+    Scalar,
+    SSE41,
+    AVX2
+  };
+
+  // The widest instruction set the CPU supports.
+  inline Isa best_isa() {
+#ifdef PIXEL_CONVERT_X86
+    static const Isa isa = []() {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+        return Isa::AVX2;
+      }
+      if (__builtin_cpu_supports("sse4.1")) {
+        return Isa::SSE41;
+      }
+      return Isa::Scalar;
+    }();
+    return isa;
+#else
+    return Isa::Scalar;
+#endif
+  }
+
+  inline uint8_t swap_bytes(uint8_t v) {
+    return v;
+  }
+
+  inline uint16_t swap_bytes(uint16_t v) {
+    return (uint16_t) ((v << 8) | (v >> 8));
+  }
+
+  template<typename S>
+  inline float to_float(S v) {
+    return v / (float) std::numeric_limits<S>::max();
+  }
+
+  // NaN stores as 0, like in the vector paths.
+  template<typename S>
+  inline S from_float(float v) {
+    const float scale = (float) std::numeric_limits<S>::max();
+    v *= scale;
+    v = v > 0.f ? v : 0.f;
+    v = v < scale ? v : scale;
+    return (S) v;
+  }
+
+  template<typename S>
+  inline void deinterleave_scalar(const S *src, float *dst, int x, int width, int channels, ptrdiff_t c_stride, bool swap) {
+    for (; x < width; x++) {
+      for (int c = 0; c < channels; c++) {
+        S s = src[x * channels + c];
+        dst[c * c_stride + x] = to_float(swap ? swap_bytes(s) : s);
+      }
+    }
+  }
+
+  template<typename S>
+  inline void interleave_scalar(const float *src, ptrdiff_t c_stride, S *dst, int x, int width, int channels, bool swap) {
+    for (; x < width; x++) {
+      for (int c = 0; c < channels; c++) {
+        S s = from_float<S>(src[c * c_stride + x]);
+        dst[x * channels + c] = swap ? swap_bytes(s) : s;
+      }
+    }
+  }
+
+#ifdef PIXEL_CONVERT_X86
+
+#define PIXEL_CONVERT_SSE41 __attribute__((target("sse4.1")))
+#define PIXEL_CONVERT_AVX2 __attribute__((target("avx2")))
+
+  // The kernels work on blocks of four pixels (two for AVX2, one per 128-bit
+  // lane). Within a block, the interleaved samples are held in channels
+  // vectors of four, v[k] holding samples 4k to 4k + 3, and transposed in
+  // registers to and from one vector per channel.
+
+  PIXEL_CONVERT_SSE41 inline __m128i swap_mask() {
+    return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  }
+
+  // Four samples at p, widened to 32 bits.
+  PIXEL_CONVERT_SSE41 inline __m128i load4(const uint8_t *p, bool) {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+  }
+
+  PIXEL_CONVERT_SSE41 inline __m128i load4(const uint16_t *p, bool swap) {
+    __m128i v = _mm_loadl_epi64((const __m128i *) p);
+    if (swap) {
+      v = _mm_shuffle_epi8(v, swap_mask());
+    }
+    return _mm_cvtepu16_epi32(v);
+  }
+
+  // Narrows four 32-bit samples, already in range, and stores them at p.
+  PIXEL_CONVERT_SSE41 inline void store4(uint8_t *p, __m128i v, bool) {
+    v = _mm_packus_epi32(v, v);
+    v = _mm_packus_epi16(v, v);
+    int32_t s = _mm_cvtsi128_si32(v);
+    memcpy(p, &s, sizeof(s));
+  }
+
+  PIXEL_CONVERT_SSE41 inline void store4(uint16_t *p, __m128i v, bool swap) {
+    v = _mm_packus_epi32(v, v);
+    if (swap) {
+      v = _mm_shuffle_epi8(v, swap_mask());
+    }
+    _mm_storel_epi64((__m128i *) p, v);
+  }
+
+  PIXEL_CONVERT_SSE41 inline void transpose4(__m128 *v) {
+    __m128 t0 = _mm_unpacklo_ps(v[0], v[1]), t1 = _mm_unpacklo_ps(v[2], v[3]);
+    __m128 t2 = _mm_unpackhi_ps(v[0], v[1]), t3 = _mm_unpackhi_ps(v[2], v[3]);
+    v[0] = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    v[1] = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    v[2] = _mm_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    v[3] = _mm_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  }
+
+  template<int channels>
+  PIXEL_CONVERT_SSE41 inline void to_planar(__m128 *v) {
+    if constexpr (channels == 2) {
+      __m128 a = v[0], b = v[1];
+      v[0] = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      v[1] = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    } else if constexpr (channels == 3) {
+      // RGBR GBRG BRGB -> RRRR GGGG BBBB
+      __m128 a = v[0], b = v[1], c = v[2];
+      v[0] = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+      v[1] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                            _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+      v[2] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                            _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    } else if constexpr (channels == 4) {
+      transpose4(v);
+    }
+  }
+
+  template<int channels>
+  PIXEL_CONVERT_SSE41 inline void to_interleaved(__m128 *v) {
+    if constexpr (channels == 2) {
+      __m128 r = v[0], g = v[1];
+      v[0] = _mm_unpacklo_ps(r, g);
+      v[1] = _mm_unpackhi_ps(r, g);
+    } else if constexpr (channels == 3) {
+      // RRRR GGGG BBBB -> RGBR GBRG BRGB
+      __m128 r = v[0], g = v[1], b = v[2];
+      v[0] = _mm_shuffle_ps(_mm_shuffle_ps(r, g, _MM_SHUFFLE(0, 0, 0, 0)),
+                            _mm_shuffle_ps(b, r, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+      v[1] = _mm_shuffle_ps(_mm_shuffle_ps(g, b, _MM_SHUFFLE(1, 1, 1, 1)),
+                            _mm_shuffle_ps(r, g, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+      v[2] = _mm_shuffle_ps(_mm_shuffle_ps(b, r, _MM_SHUFFLE(3, 3, 2, 2)),
+                            _mm_shuffle_ps(g, b, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    } else if constexpr (channels == 4) {
+      transpose4(v);
+    }
+  }
+
+  // Each kernel converts whole blocks from the start of the row and returns
+  // the number of pixels it converted.
+  template<typename S, int channels>
+  PIXEL_CONVERT_SSE41 inline int deinterleave_sse41(const S *src, float *dst, int width, ptrdiff_t c_stride, bool swap) {
+    const __m128 scale = _mm_set1_ps((float) std::numeric_limits<S>::max());
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      __m128 v[channels];
+      for (int k = 0; k < channels; k++) {
+        v[k] = _mm_div_ps(_mm_cvtepi32_ps(load4(src + x * channels + 4 * k, swap)), scale);
+      }
+      to_planar<channels>(v);
+      for (int c = 0; c < channels; c++) {
+        _mm_storeu_ps(dst + c * c_stride + x, v[c]);
+      }
+    }
+    return x;
+  }
+
+  template<typename S, int channels>
+  PIXEL_CONVERT_SSE41 inline int interleave_sse41(const float *src, ptrdiff_t c_stride, S *dst, int width, bool swap) {
+    const __m128 scale = _mm_set1_ps((float) std::numeric_limits<S>::max());
+    const __m128 zero = _mm_setzero_ps();
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      __m128 v[channels];
+      for (int c = 0; c < channels; c++) {
+        v[c] = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + c * c_stride + x), scale), zero), scale);
+      }
+      to_interleaved<channels>(v);
+      for (int k = 0; k < channels; k++) {
+        store4(dst + x * channels + 4 * k, _mm_cvttps_epi32(v[k]), swap);
+      }
+    }
+    return x;
+  }
+
+  // AVX2 holds two blocks of four pixels, one per 128-bit lane; the
+  // in-lane shuffles transpose both at once.
+
+  PIXEL_CONVERT_AVX2 inline __m256i load8(const uint8_t *p0, const uint8_t *p1, bool) {
+    int32_t a, b;
+    memcpy(&a, p0, sizeof(a));
+    memcpy(&b, p1, sizeof(b));
+    return _mm256_cvtepu8_epi32(_mm_unpacklo_epi32(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b)));
+  }
+
+  PIXEL_CONVERT_AVX2 inline __m256i load8(const uint16_t *p0, const uint16_t *p1, bool swap) {
+    __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) p0), _mm_loadl_epi64((const __m128i *) p1));
+    if (swap) {
+      v = _mm_shuffle_epi8(v, swap_mask());
+    }
+    return _mm256_cvtepu16_epi32(v);
+  }
+
+  PIXEL_CONVERT_AVX2 inline void transpose4(__m256 *v) {
+    __m256 t0 = _mm256_unpacklo_ps(v[0], v[1]), t1 = _mm256_unpacklo_ps(v[2], v[3]);
+    __m256 t2 = _mm256_unpackhi_ps(v[0], v[1]), t3 = _mm256_unpackhi_ps(v[2], v[3]);
+    v[0] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    v[1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    v[2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    v[3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  }
+
+  template<int channels>
+  PIXEL_CONVERT_AVX2 inline void to_planar(__m256 *v) {
+    if constexpr (channels == 2) {
+      __m256 a = v[0], b = v[1];
+      v[0] = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      v[1] = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    } else if constexpr (channels == 3) {
+      __m256 a = v[0], b = v[1], c = v[2];
+      v[0] = _mm256_shuffle_ps(a, _mm256_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+      v[1] = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                               _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+      v[2] = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                               _mm256_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    } else if constexpr (channels == 4) {
+      transpose4(v);
+    }
+  }
+
+  template<int channels>
+  PIXEL_CONVERT_AVX2 inline void to_interleaved(__m256 *v) {
+    if constexpr (channels == 2) {
+      __m256 r = v[0], g = v[1];
+      v[0] = _mm256_unpacklo_ps(r, g);
+      v[1] = _mm256_unpackhi_ps(r, g);
+    } else if constexpr (channels == 3) {
+      __m256 r = v[0], g = v[1], b = v[2];
+      v[0] = _mm256_shuffle_ps(_mm256_shuffle_ps(r, g, _MM_SHUFFLE(0, 0, 0, 0)),
+                               _mm256_shuffle_ps(b, r, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+      v[1] = _mm256_shuffle_ps(_mm256_shuffle_ps(g, b, _MM_SHUFFLE(1, 1, 1, 1)),
+                               _mm256_shuffle_ps(r, g, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+      v[2] = _mm256_shuffle_ps(_mm256_shuffle_ps(b, r, _MM_SHUFFLE(3, 3, 2, 2)),
+                               _mm256_shuffle_ps(g, b, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    } else if constexpr (channels == 4) {
+      transpose4(v);
+    }
+  }
+
+  template<typename S, int channels>
+  PIXEL_CONVERT_AVX2 inline int deinterleave_avx2(const S *src, float *dst, int width, ptrdiff_t c_stride, bool swap) {
+    const __m256 scale = _mm256_set1_ps((float) std::numeric_limits<S>::max());
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+      const S *block0 = src + x * channels, *block1 = src + (x + 4) * channels;
+      __m256 v[channels];
+      for (int k = 0; k < channels; k++) {
+        v[k] = _mm256_div_ps(_mm256_cvtepi32_ps(load8(block0 + 4 * k, block1 + 4 * k, swap)), scale);
+      }
+      to_planar<channels>(v);
+      for (int c = 0; c < channels; c++) {
+        _mm256_storeu_ps(dst + c * c_stride + x, v[c]);
+      }
+    }
+    return x + deinterleave_sse41<S, channels>(src + x * channels, dst + x, width - x, c_stride, swap);
+  }
+
+  template<typename S, int channels>
+  PIXEL_CONVERT_AVX2 inline int interleave_avx2(const float *src, ptrdiff_t c_stride, S *dst, int width, bool swap) {
+    const __m256 scale = _mm256_set1_ps((float) std::numeric_limits<S>::max());
+    const __m256 zero = _mm256_setzero_ps();
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+      __m256 v[channels];
+      for (int c = 0; c < channels; c++) {
+        v[c] = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + c * c_stride + x), scale), zero), scale);
+      }
+      to_interleaved<channels>(v);
+      S *block0 = dst + x * channels, *block1 = dst + (x + 4) * channels;
+      for (int k = 0; k < channels; k++) {
+        __m256i s = _mm256_cvttps_epi32(v[k]);
+        store4(block0 + 4 * k, _mm256_castsi256_si128(s), swap);
+        store4(block1 + 4 * k, _mm256_extracti128_si256(s, 1), swap);
+      }
+    }
+    return x + interleave_sse41<S, channels>(src + x, c_stride, dst + x * channels, width - x, swap);
+  }
+
+#endif // PIXEL_CONVERT_X86
+
+  template<typename S, int channels>
+  inline int deinterleave_simd(const S *src, float *dst, int width, ptrdiff_t c_stride, bool swap, Isa isa) {
+#ifdef PIXEL_CONVERT_X86
+    if (isa == Isa::AVX2) {
+      return deinterleave_avx2<S, channels>(src, dst, width, c_stride, swap);
+    } else if (isa == Isa::SSE41) {
+      return deinterleave_sse41<S, channels>(src, dst, width, c_stride, swap);
+    }
+#endif
+    return 0;
+  }
+
+  template<typename S, int channels>
+  inline int interleave_simd(const float *src, ptrdiff_t c_stride, S *dst, int width, bool swap, Isa isa) {
+#ifdef PIXEL_CONVERT_X86
+    if (isa == Isa::AVX2) {
+      return interleave_avx2<S, channels>(src, c_stride, dst, width, swap);
+    } else if (isa == Isa::SSE41) {
+      return interleave_sse41<S, channels>(src, c_stride, dst, width, swap);
+    }
+#endif
+    return 0;
+  }
+
+  // Converts a row of width pixels of channels interleaved uint8_t or
+  // uint16_t samples to planar floats in [0, 1], channel c of pixel x going
+  // to dst[c * c_stride + x]. swap byte-swaps 16-bit samples first, e.g.
+  // big-endian file data on a little-endian machine.
+  template<typename S>
+  inline void deinterleave(const S *src, float *dst, int width, int channels, ptrdiff_t c_stride,
+                           bool swap = false, Isa isa = best_isa()) {
+    int x = 0;
+    switch (channels) {
+      case 1: x = deinterleave_simd<S, 1>(src, dst, width, c_stride, swap, isa); break;
+      case 2: x = deinterleave_simd<S, 2>(src, dst, width, c_stride, swap, isa); break;
+      case 3: x = deinterleave_simd<S, 3>(src, dst, width, c_stride, swap, isa); break;
+      case 4: x = deinterleave_simd<S, 4>(src, dst, width, c_stride, swap, isa); break;
+    }
+    deinterleave_scalar(src, dst, x, width, channels, c_stride, swap);
+  }
+
+  // The inverse of deinterleave: planar floats to interleaved samples,
+  // byte-swapped after conversion if swap is set.
+  template<typename S>
+  inline void interleave(const float *src, ptrdiff_t c_stride, S *dst, int width, int channels,
+                         bool swap = false, Isa isa = best_isa()) {
+    int x = 0;
+    switch (channels) {
+      case 1: x = interleave_simd<S, 1>(src, c_stride, dst, width, swap, isa); break;
+      case 2: x = interleave_simd<S, 2>(src, c_stride, dst, width, swap, isa); break;
+      case 3: x = interleave_simd<S, 3>(src, c_stride, dst, width, swap, isa); break;
+      case 4: x = interleave_simd<S, 4>(src, c_stride, dst, width, swap, isa); break;
+    }
+    interleave_scalar(src, c_stride, dst, x, width, channels, swap);
+  }
+
+} // namespace PixelConvert
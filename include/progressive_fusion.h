@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <HalideBuffer.h>
+#include "quality_measures.h"
+
+using Halide::Runtime::Buffer;
+
+namespace Measures {
+
+  // Fuses a bracket coarse to fine, so that a low-resolution result can be
+  // shown long before the full-resolution one is ready. Step k fuses level k
+  // of the Laplacian pyramid: it reduces the exposures to level k, measures
+  // the weights there, blends their detail at that level and adds it to the
+  // upsampled result of step k + 1. Refining thus reuses every coarser level
+  // instead of starting over, and all the steps down to full resolution cost
+  // about 4/3 of a single full-resolution fusion.
+  //
+  // Each level is reduced from the exposures in one pass
+  // (Pyramid::reduce_level), at a cost proportional to its own size, so the
+  // first step doesn't wait for the finer levels, and only the levels of the
+  // last step are held. Since the levels are box-filtered rather than
+  // Gaussian and weighted by weights measured at that level, the final
+  // result is close to, but not the same as, compute_pyramid_fusion with
+  // compute_bracket weights. The exposures must not change while they are
+  // refined; an empty bracket throws std::invalid_argument. Not thread-safe.
+  class ProgressiveFusion {
+  public:
+    ProgressiveFusion(
+      const std::vector<Buffer<float>> &in,
+      float c_weight = 1.f,
+      float s_weight = 1.f,
+      float e_weight = 1.f,
+      Math math = Math::Exact
+    );
+
+    // Refines by one level, then by more as long as the next level is
+    // expected to be done within budget_ms of the call, extrapolating from
+    // the time of the last level. Returns the result at the finest level
+    // reached.
+    Buffer<float> refine(double budget_ms = INFINITY);
+
+    // The level of result(): 0 is full resolution, levels() - 1 the
+    // coarsest, levels() before the first call to refine.
+    int level() const { return current; }
+    int levels() const { return num_levels; }
+    bool finished() const { return current == 0; }
+
+    // The latest result, (x, y, c) at the resolution of level().
+    Buffer<float> result() const { return fusion; }
+
+  private:
+    // Fuses level current - 1.
+    void step();
+
+    std::vector<Buffer<float>> in;
+    float c_weight, s_weight, e_weight;
+    Math math;
+    int num_levels, current;
+    std::vector<int> widths, heights;
+
+    // The exposures reduced to the level of the current result, whose
+    // upsampling the next step subtracts from its own.
+    std::vector<Buffer<float>> coarse;
+    Buffer<float> fusion;
+  };
+
+} // namespace Measures
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <HalideBuffer.h>
+#include "stage_report.h"
+
+using Halide::Runtime::Buffer;
+
+namespace Pyramid {
+
+  // Number of levels of the pyramids of a width x height image.
+  int levels(int width, int height);
+
+  // Extent of the next coarser level.
+  inline int coarser(int extent) {
+    return (extent + 1) / 2;
+  }
+
+  // The type of levels stored as float16.
+  const halide_type_t float16_type(halide_type_float, 16);
+
+  // Level kernels, realized into caller-provided (x, y, c) buffers; weights
+  // have one channel. Levels are stored as float or float16 and computed in
+  // float. Each kernel is compiled ahead of time from
+  // generators/pyramid_generator.cpp, once per set of level types the blends
+  // use and once for one, three and any number of channels; the large levels
+  // are computed in parallel, vectorized rows, the small ones near the top
+  // serially. Kernels that take acc update it in place.
+
+  // out = downsample(in), with the [1, 3, 3, 1] / 8 filter.
+  void downsample_level(const Buffer<> &in, Buffer<> &out);
+
+  // out = the mean of in over blocks of factor x factor pixels, a power of
+  // two, sampled on a grid of at most 4 x 4 pixels of each block: a
+  // box-filtered level of any depth in one pass whose cost depends on the
+  // size of out, not of in. Up to a factor of 4 every pixel of in is read.
+  // out is ceil(in / factor) in each dimension.
+  void reduce_level(const Buffer<> &in, Buffer<> &out, int factor);
+
+  // acc += (fine - upsample(coarse)) * weight: one exposure's contribution
+  // to a level of the blended Laplacian pyramid.
+  void accumulate_level(Buffer<> &acc, const Buffer<> &fine, const Buffer<> &coarse, const Buffer<> &weight);
+
+  // acc += fine * weight, at the top level where the Laplacian pyramid
+  // holds the Gaussian level itself.
+  void accumulate_top(Buffer<> &acc, const Buffer<> &fine, const Buffer<> &weight);
+
+  // out = level + upsample(coarse), upsampled bilinearly. out may be level.
+  void collapse_level(const Buffer<> &level, const Buffer<> &coarse, Buffer<> &out);
+
+  // acc += level.
+  void add_level(Buffer<> &acc, const Buffer<> &level);
+
+  // level /= weight_sum, which has one channel.
+  void normalize_level(Buffer<> &level, const Buffer<> &weight_sum);
+
+  // Recycles level buffers across the levels of a blend, its exposures and
+  // successive blends. A released buffer is handed out again, cropped, for
+  // any level it is large enough for, so the Gaussian levels of an exposure
+  // ping-pong between two buffers and a blend of an image shape seen before
+  // allocates nothing but its result. Thread-safe.
+  class LevelPool {
+  public:
+    struct Stats {
+      int allocations = 0;    // Buffers allocated so far.
+      size_t bytes = 0;       // Bytes held now, in use or free.
+      size_t peak_bytes = 0;  // Most bytes held at once.
+    };
+
+    // Without reuse, released buffers are freed and every acquire allocates,
+    // which is how the engine used to behave.
+    explicit LevelPool(bool reuse = true);
+
+    // Returns a width x height x channels buffer of type with min (0, 0, 0).
+    Buffer<> acquire(int width, int height, int channels, halide_type_t type = halide_type_of<float>());
+
+    // Gives back a buffer returned by acquire.
+    void release(const Buffer<> &level);
+
+    Stats stats() const;
+
+    // Frees the buffers not in use.
+    void clear();
+
+  private:
+    struct Entry {
+      Buffer<> buffer;
+      bool in_use;
+    };
+
+    bool reuse;
+    std::vector<Entry> entries;
+    Stats counters;
+    mutable std::mutex lock;
+  };
+
+  // Blends the exposures in with their normalized weights (x, y, n) in a
+  // Laplacian pyramid with levels levels (0 picks levels(width, height)),
+  // over all the channels. Scratch levels come from pool, or from a
+  // process-wide pool if it is null. report, if not null, receives the
+  // time spent in each kernel at each level, e.g. "downsample[2]" for the
+  // level 2 downsamples of all the exposures. The Gaussian levels of the
+  // exposures and weights and the blended levels are stored as storage,
+  // float or float16_type; the caller's level 0 and the result are float.
+  Buffer<float> blend(
+    const std::vector<Buffer<float>> &in,
+    const Buffer<float> &normalized_weights,
+    int levels = 0,
+    LevelPool *pool = nullptr,
+    Measures::Report *report = nullptr,
+    halide_type_t storage = halide_type_of<float>()
+  );
+
+  // Blends images one at a time with weights that aren't normalized, keeping
+  // only running sums: the Laplacian pyramid of the images weighted by the
+  // Gaussian pyramid of their weights, and the Gaussian pyramid of the
+  // weights. finish() divides each level of the first by the same level of
+  // the second and collapses the result. Memory doesn't depend on the number
+  // of images, and an image can be freed as soon as it is added.
+  //
+  // Normalizing each level by the sum of the weights at that level is close
+  // to, but not the same as, blend with weights normalized at full
+  // resolution; level 0 is the same.
+  class Accumulator {
+  public:
+    // levels = 0 picks levels(width, height) from the first image. Scratch
+    // and running levels come from pool, or from one of the accumulator's
+    // own if it is null.
+    explicit Accumulator(int levels = 0, LevelPool *pool = nullptr);
+
+    // Adds image (x, y, c) with weight (x, y). Every image must have the
+    // size of the first.
+    void add(const Buffer<float> &image, const Buffer<float> &weight);
+
+    // Number of images added since the last finish().
+    int count() const { return images; }
+
+    // Returns the blend of the images added so far and starts over.
+    Buffer<float> finish();
+
+  private:
+    int requested_levels, num_levels = 0, images = 0;
+    LevelPool own_pool;
+    LevelPool *pool;
+    std::vector<int> widths, heights;
+    std::vector<Buffer<>> blended;      // Sums of weighted Laplacian levels.
+    std::vector<Buffer<>> weight_sums;  // Sums of Gaussian levels of the weights.
+  };
+
+} // namespace Pyramid
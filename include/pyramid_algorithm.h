@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Halide.h>
+
+using Halide::Func;
+using Halide::Expr;
+
+namespace Pyramid {
+
+  // Levels of at least parallel_extent in both dimensions are computed in
+  // parallel, vectorized rows, the small levels near the top serially.
+  const int parallel_extent = 64;
+
+  // The most samples of a block, in each dimension, a reduce reads.
+  const int reduce_taps = 4;
+
+  // Upsamples by two with bilinear interpolation. input must be defined past
+  // its borders (e.g. clamped). Trailing dimensions are carried through.
+  Func upsample(Func input);
+
+  // Downsamples by two with the [1, 3, 3, 1] / 8 filter. input must be
+  // defined past its borders. Trailing dimensions are carried through.
+  Func downsample(Func input);
+
+  // The mean of input over blocks of factor x factor pixels, sampled on a
+  // grid of at most reduce_taps x reduce_taps pixels of each block. input
+  // must be defined past its borders and have (x, y, c) dimensions.
+  Func reduce(Func input, Expr factor);
+
+  // Schedules a level kernel realizing output (x, y, c) of width x height.
+  // Every schedule keeps the channels innermost, and channels > 0 unrolls
+  // them, so each vector of a weight is loaded once for all channels. Rows
+  // are computed in strips of eight, in parallel and vectorized when the
+  // level is at least parallel_extent in both dimensions. Tails are guarded
+  // rather than recomputed, so output may be the buffer of an input.
+  void schedule_level(Func output, int channels, Expr width, Expr height);
+
+} // namespace Pyramid
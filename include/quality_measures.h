@@ -2,10 +2,14 @@
 
 #include <iostream>
 #include <cmath>
-#include <Halide.h>
+#include <functional>
+#include <map>
+#include <vector>
+#include <HalideBuffer.h>
+#include "pyramid.h"
+#include "stage_report.h"
 
-using Halide::Func;
-using Halide::Buffer;
+using Halide::Runtime::Buffer;
 
 namespace Measures {
 
@@ -19,17 +23,277 @@ namespace Measures {
     Weight
   };
 
+  enum class Schedule {
+    Tiled,  // Parallel, vectorized tiles; the default.
+    Root    // Every stage computed at root, the original schedule.
+  };
+
+  enum class Math {
+    Exact,  // Exposure in double precision, weights as a product of pow.
+    Fast    // Float only, one exp for exposure, weights in the log domain.
+  };
+
+  enum class Storage {
+    Float32,  // Intermediates stored as float; the default.
+    Float16   // Intermediates stored as float16 and computed in float.
+  };
+
+  // Debug intermediates are computed by compute_intermediates, whatever the
+  // schedule. If report isn't null, the pipeline that runs (the weight map's,
+  // or the debug intermediates') is a profiled build, and report receives
+  // the time, memory and threads of each of its Funcs.
   Buffer<float> compute(
     const Buffer<float> &in, 
     float c_weight = 1.f, 
     float s_weight = 1.f, 
     float e_weight = 1.f,
-    DebugIntermediate debug_intermediate = DebugIntermediate::None
+    DebugIntermediate debug_intermediate = DebugIntermediate::None,
+    Schedule schedule = Schedule::Tiled,
+    Math math = Math::Exact,
+    Report *report = nullptr
+  );
+
+  // compute on the samples of an 8 or 16-bit file, which the pipeline
+  // normalizes to [0, 1] as it reads them, so the frame is never held as
+  // float. The tiled schedule has integer builds, profiled ones included;
+  // the root schedule and debug intermediates convert the frame first, and
+  // report the conversion as a stage of its own, to_float.
+  Buffer<float> compute(
+    const Buffer<uint8_t> &in,
+    float c_weight = 1.f,
+    float s_weight = 1.f,
+    float e_weight = 1.f,
+    DebugIntermediate debug_intermediate = DebugIntermediate::None,
+    Schedule schedule = Schedule::Tiled,
+    Math math = Math::Exact,
+    Report *report = nullptr
+  );
+
+  Buffer<float> compute(
+    const Buffer<uint16_t> &in,
+    float c_weight = 1.f,
+    float s_weight = 1.f,
+    float e_weight = 1.f,
+    DebugIntermediate debug_intermediate = DebugIntermediate::None,
+    Schedule schedule = Schedule::Tiled,
+    Math math = Math::Exact,
+    Report *report = nullptr
   );
 
+  // Computes the requested intermediates of the weight pipeline in a single
+  // pass, sharing the stages they have in common. None asks for the weight.
+  // The pass is compiled ahead of time with every intermediate as an output,
+  // so the ones not requested are computed as well.
+  std::map<DebugIntermediate, Buffer<float>> compute_intermediates(
+    const Buffer<float> &in,
+    const std::vector<DebugIntermediate> &intermediates,
+    float c_weight = 1.f,
+    float s_weight = 1.f,
+    float e_weight = 1.f,
+    Math math = Math::Exact
+  );
+
+  // Computes the normalized weight maps of every exposure of a bracket, in
+  // one pass over tiles that computes the raw weights of every exposure, their
+  // sum and the normalization while the tile is in cache. The exposures are
+  // read where they are. Brackets of more than 8 (bracket_max_frames) exposures
+  // take a second pass, which normalizes the weight maps in place. The
+  // result is indexed (x, y, n), n being the exposure.
+  Buffer<float> compute_bracket(
+    const std::vector<Buffer<float>> &in,
+    float c_weight = 1.f,
+    float s_weight = 1.f,
+    float e_weight = 1.f,
+    Math math = Math::Exact
+  );
+
+  // The compute_fusion overloads blend one exposure at a time into running
+  // sums, reading each where it is, so a bracket is never copied. They fill
+  // report, if not null, like compute.
   Buffer<float> compute_fusion(
   const std::vector<Buffer<float>> &in, 
-  const std::vector<Buffer<float>> &weight_maps 
+  const std::vector<Buffer<float>> &weight_maps,
+  Report *report = nullptr
 );
 
+  // Blends a bracket with weights that are already normalized, as returned
+  // by compute_bracket.
+  Buffer<float> compute_fusion(
+    const std::vector<Buffer<float>> &in,
+    const Buffer<float> &normalized_weights,
+    Report *report = nullptr
+  );
+
+  // The compute_fusion overloads on 8 and 16-bit exposures, normalized to
+  // [0, 1] inside the pipeline. The result is float like the float path's.
+  // Profiled runs (report not null) read the integer exposures too.
+  Buffer<float> compute_fusion(
+    const std::vector<Buffer<uint8_t>> &in,
+    const std::vector<Buffer<float>> &weight_maps,
+    Report *report = nullptr
+  );
+
+  Buffer<float> compute_fusion(
+    const std::vector<Buffer<uint16_t>> &in,
+    const std::vector<Buffer<float>> &weight_maps,
+    Report *report = nullptr
+  );
+
+  Buffer<float> compute_fusion(
+    const std::vector<Buffer<uint8_t>> &in,
+    const Buffer<float> &normalized_weights,
+    Report *report = nullptr
+  );
+
+  Buffer<float> compute_fusion(
+    const std::vector<Buffer<uint16_t>> &in,
+    const Buffer<float> &normalized_weights,
+    Report *report = nullptr
+  );
+
+  // Blends a bracket with normalized weights (x, y, n), as returned by
+  // compute_bracket, in a Laplacian pyramid over all channels. levels = 0
+  // picks the number of levels from the image size. report, if not null,
+  // receives the time of each level kernel. Storage::Float16 stores the
+  // Gaussian levels of the exposures and weights and the blended levels
+  // as float16, which halves their memory and bandwidth.
+  Buffer<float> compute_pyramid_fusion(
+    const std::vector<Buffer<float>> &in,
+    const Buffer<float> &normalized_weights,
+    int levels = 0,
+    Report *report = nullptr,
+    Storage storage = Storage::Float32
+  );
+
+  // How far a result is from a reference, e.g. a fusion with
+  // Storage::Float16 from the same fusion with Storage::Float32.
+  struct StorageError {
+    float max_error = 0.f;  // Largest absolute difference of a sample.
+    float rms_error = 0.f;  // Root mean square difference.
+    float psnr = 0.f;       // In dB, for samples in [0, 1]; infinite if equal.
+  };
+
+  StorageError storage_error(const Buffer<float> &result, const Buffer<float> &reference);
+
+  // Fills strip, an (x, y, c) buffer spanning the image width and some of its
+  // rows, with those rows of exposure frame.
+  typedef std::function<void(int frame, Buffer<float> &strip)> StripSource;
+
+  // Receives the fused image one strip of rows at a time, top to bottom.
+  typedef std::function<void(const Buffer<float> &strip)> StripSink;
+
+  // Computes the weights and the fusion of a bracket in horizontal strips of
+  // strip_height rows (rounded up to whole tiles of the weight schedule).
+  // Each strip pulls its rows of every exposure from source, plus the rows
+  // the laplacian stencil reads around them, one exposure at a time, so
+  // memory is bounded by the size of one strip of one exposure rather than
+  // the image size. The result is bit-identical to compute_fusion with
+  // weight maps from compute.
+  void compute_fusion_streaming(
+    int width,
+    int height,
+    int channels,
+    int frames,
+    const StripSource &source,
+    const StripSink &sink,
+    int strip_height = 256,
+    float c_weight = 1.f,
+    float s_weight = 1.f,
+    float e_weight = 1.f
+  );
+
+  // compute_fusion_streaming over exposures that are already in memory.
+  Buffer<float> compute_fusion_streaming(
+    const std::vector<Buffer<float>> &in,
+    int strip_height = 256,
+    float c_weight = 1.f,
+    float s_weight = 1.f,
+    float e_weight = 1.f
+  );
+
+  // Keeps the contrast, saturation and exposure of every exposure of a
+  // bracket, so that retuning the exponents only recomputes the weights,
+  // their normalization and the blend, in one pass over the kept measures
+  // and the exposures. The measures are kept as logs, which turns the three
+  // pows of a weight into one exp; like Math::Fast, a zero measure gives a
+  // tiny weight rather than zero. Keeping them takes 12 bytes per pixel per
+  // exposure.
+  //
+  // The fused pass reads the bracket stacked as one (x, y, c, n) buffer,
+  // which the session shares with the caller rather than copies: a caller
+  // that decodes or renders its exposures into the planes of one buffer
+  // pays nothing for it. Not thread-safe.
+  class TuningSession {
+  public:
+    TuningSession() = default;
+    explicit TuningSession(const Buffer<float> &bracket);
+
+    // Replaces the bracket, (x, y, c, n). Measures are computed on the next
+    // call that needs them.
+    void set_bracket(const Buffer<float> &bracket);
+
+    // Copies frame into exposure i of the bracket, or, with the bracket's own
+    // plane, tells the session that it changed in place: only its measures
+    // are computed again.
+    void set_frame(int i, const Buffer<float> &frame);
+
+    // The normalized weight maps (x, y, n), like compute_bracket's.
+    Buffer<float> normalized_weights(float c_weight = 1.f, float s_weight = 1.f, float e_weight = 1.f);
+
+    // The fusion, like compute_fusion with compute_bracket's weights.
+    Buffer<float> fusion(float c_weight = 1.f, float s_weight = 1.f, float e_weight = 1.f);
+
+    // The fusion, like compute_pyramid_fusion with compute_bracket's weights.
+    Buffer<float> pyramid_fusion(
+      float c_weight = 1.f,
+      float s_weight = 1.f,
+      float e_weight = 1.f,
+      int levels = 0,
+      Storage storage = Storage::Float32
+    );
+
+  private:
+    // Computes the measures of the exposures that changed.
+    void update();
+
+    Buffer<float> frames;        // (x, y, c, n), the caller's.
+    Buffer<float> log_measures;  // (x, y, m, n), m = contrast, saturation, exposure.
+    std::vector<bool> stale;
+  };
+
+  // Fuses a stack of exposures added one at a time, e.g. the 30 to 60
+  // frames of a bracketed timelapse, in a Laplacian pyramid whose memory
+  // doesn't grow with the number of frames. Only running sums are kept (see
+  // Pyramid::Accumulator), so a frame can be freed once add_frame returns.
+  // Since the weights are normalized level by level at the end, the result
+  // is close to compute_pyramid_fusion's rather than the same.
+  class FusionAccumulator {
+  public:
+    explicit FusionAccumulator(
+      float c_weight = 1.f,
+      float s_weight = 1.f,
+      float e_weight = 1.f,
+      Math math = Math::Exact,
+      int levels = 0,
+      Pyramid::LevelPool *pool = nullptr
+    );
+
+    // Adds a frame with the weight compute gives it.
+    void add_frame(const Buffer<float> &image);
+
+    // Adds a frame with a weight map (x, y) of the caller's, not normalized.
+    void add_frame(const Buffer<float> &image, const Buffer<float> &weight_map);
+
+    // Number of frames added since the last finish().
+    int frames() const { return pyramid.count(); }
+
+    // Returns the fusion of the frames added so far and starts over.
+    Buffer<float> finish();
+
+  private:
+    float c_weight, s_weight, e_weight;
+    Math math;
+    Pyramid::Accumulator pyramid;
+  };
+
 } // namespace Measures
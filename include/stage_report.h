@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Measures {
+
+  // Where the time of one stage (a Func, or a pyramid level kernel) went.
+  struct StageReport {
+    std::string name;
+    double time_ms = 0.0;
+    double percentage = 0.0;  // Of the report's total time.
+    size_t peak_bytes = 0;    // Most heap memory the stage held at once.
+    double threads = 0.0;     // Average number of threads busy on it, 0 if not sampled.
+  };
+
+  // Per-stage breakdown of a call, filled in instead of printed so callers
+  // can feed it to their own metrics.
+  struct Report {
+    std::string pipeline;
+    double time_ms = 0.0;     // Sum of the stage times.
+    size_t peak_bytes = 0;    // Most heap memory held at once by the call.
+    std::vector<StageReport> stages;
+  };
+
+  // Calls run, which runs ahead-of-time pipelines compiled with the profile
+  // target feature, and adds the time the Halide profiler sampled in each of
+  // their Funcs to report. Profiled runs are serialized since the profiler
+  // state is process-wide. The profiler samples every millisecond, so stages
+  // much shorter than that are only accurate over many runs. Returns the
+  // error code of run.
+  int run_profiled(Report &report, const std::function<int()> &run);
+
+  // Adds time and memory to the stage named stage, for code timed without
+  // the profiler.
+  void add_stage(Report &report, const std::string &stage, double time_ms, size_t peak_bytes = 0, double threads = 0.0);
+
+  // Sets the total time and the percentages of the stages.
+  void finish_report(Report &report);
+
+} // namespace Measures
@@ -1,88 +1,118 @@
 #ifndef _TIMING_H_
 #define _TIMING_H_
 
-#define N_TIMES 10
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
 
 /**
- * Millisecond-precision timer function
- * \return Clock value in milliseconds
+ * Nanosecond-resolution monotonic timer
+ * \return Clock value in nanoseconds, from an arbitrary origin
  *
- * This routine implements a timer with millisecond precision.  In order to
- * obtain timing at high resolution, platform-specific functions are needed:
- *
- *    - On Windows systems, the GetSystemTime function is used.
- *    - On Mac and POSIX systems, the gettimeofday function is used.
- *
- * Preprocessor symbols are checked in attempt to detect whether the platform
- * is POSIX or Windows or Mac and defines millisecond_timer() accordingly.
+ * Uses std::chrono::steady_clock, which never goes backwards, unlike the
+ * wall clock.
  */
-#if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64)
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-unsigned long millisecond_timer(void) {
-    static SYSTEMTIME t;
-    GetSystemTime(&t);
-    return (unsigned long)((unsigned long)t.wMilliseconds
-            + 1000*((unsigned long)t.wSecond
-            + 60*((unsigned long)t.wMinute
-            + 60*((unsigned long)t.wHour
-            + 24*(unsigned long)t.wDay))));
-
-#elif defined(_APPLE_) || defined(__APPLE__) || \
-    defined(APPLE)   || defined(_APPLE)    || defined(__APPLE) || \
-defined(unix)    || defined(__unix__)  || defined(__unix)
-#include <unistd.h>
-#include <sys/time.h>
-unsigned long millisecond_timer(void) {
-    struct timeval t;
-    gettimeofday(&t, NULL);
-    return (unsigned long)(t.tv_usec/1000 + t.tv_sec*1000);
+inline uint64_t nanosecond_timer(void) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
 }
-#else
-unsigned long millisecond_timer(void) {
-    std::cout << "Warning: no timer implementation available" << std::endl;
-    return 0;
+
+/**
+ * Millisecond timer, kept for existing callers
+ * \return Clock value in milliseconds, from an arbitrary origin
+ */
+inline unsigned long millisecond_timer(void) {
+    return (unsigned long) (nanosecond_timer() / 1000000);
 }
-#endif
 
+/**
+ * How many times the profiler runs what it measures.
+ *
+ * After warmup untimed runs, it runs at least min_iterations times and keeps
+ * going until min_time_ms has elapsed, or until max_iterations runs.
+ */
+struct ProfileOptions {
+    int warmup = 1;
+    int min_iterations = 5;
+    int max_iterations = 10000;
+    double min_time_ms = 200.0;
+};
 
 /**
- * Print the runtime and throughout and return the runtime.
+ * Runtime statistics over the timed runs, in milliseconds.
  */
-float profile(Func myFunc, int w, int h) {
-    myFunc.compile_jit();
+struct ProfileStats {
+    int iterations = 0;
+    double min_ms = 0.0;
+    double median_ms = 0.0;
+    double p95_ms = 0.0;
+    double mean_ms = 0.0;
+    double stddev_ms = 0.0;
+};
 
-    unsigned long s = millisecond_timer();
-    for (int i=0; i<N_TIMES; i++) {
-        myFunc.realize({w,h});
+/**
+ * Statistics of the runtimes, in milliseconds, of a set of runs.
+ */
+inline ProfileStats profile_stats(std::vector<double> samples) {
+    ProfileStats stats;
+    if (samples.empty()) {
+        return stats;
     }
-    float total_time = float(millisecond_timer()-s);
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
 
-    float mpixels = float(w*h)/1e6;
-    std::cout << "runtime " << total_time/N_TIMES << " ms "
-        << " throughput " << (mpixels*N_TIMES)/(total_time/1000) << " megapixels/sec" << std::endl;
+    double sum = 0.0;
+    for (double t : samples) {
+        sum += t;
+    }
+    double mean = sum / n;
+    double squares = 0.0;
+    for (double t : samples) {
+        squares += (t - mean) * (t - mean);
+    }
 
-    return total_time/N_TIMES;
+    stats.iterations = (int) n;
+    stats.min_ms = samples[0];
+    stats.median_ms = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    stats.p95_ms = samples[std::min(n - 1, (size_t) std::ceil(0.95 * n) - 1)];
+    stats.mean_ms = mean;
+    stats.stddev_ms = n > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+    return stats;
 }
 
-
 /**
- * Print the runtime and throughout and return the runtime.
+ * Time any callable, each run separately.
  */
-float profile(Func myFunc, int w, int h, int c) {
-    myFunc.compile_jit();
-
-    unsigned long s = millisecond_timer();
-    for (int i=0; i<N_TIMES; i++) {
-        myFunc.realize({w,h,c});
+template<typename F>
+ProfileStats profile_callable(F &&f, const ProfileOptions &options = ProfileOptions()) {
+    for (int i = 0; i < options.warmup; i++) {
+        f();
     }
-    float total_time = float(millisecond_timer()-s);
 
-    float mpixels = float(w*h)/1e6;
-    std::cout << " runtime " << total_time/N_TIMES << " ms "
-        << " throughput " << (mpixels*N_TIMES)/(total_time/1000) << " megapixels/sec" << std::endl;
+    std::vector<double> samples;
+    double total_ms = 0.0;
+    while ((int) samples.size() < options.max_iterations &&
+           ((int) samples.size() < options.min_iterations || total_ms < options.min_time_ms)) {
+        uint64_t s = nanosecond_timer();
+        f();
+        double ms = (nanosecond_timer() - s) / 1e6;
+        samples.push_back(ms);
+        total_ms += ms;
+    }
+    return profile_stats(samples);
+}
 
-    return total_time/N_TIMES;
+/**
+ * Print the statistics, and the throughput at the median runtime.
+ */
+inline void print_profile(const ProfileStats &stats, float mpixels) {
+    std::cout << " runtime " << stats.median_ms << " ms "
+        << " (min " << stats.min_ms << ", p95 " << stats.p95_ms
+        << ", stddev " << stats.stddev_ms << ", " << stats.iterations << " runs) "
+        << " throughput " << mpixels / (stats.median_ms / 1000) << " megapixels/sec" << std::endl;
 }
 
 #endif // _TIMING_H_
@@ -2,4 +2,8 @@
 
 #include <Halide.h>
 
-void apply_auto_schedule(Halide::Func F);
\ No newline at end of file
+void apply_auto_schedule(Halide::Func F);
+
+// Returns the Func named name among the Funcs F calls, directly or not, so
+// stages made inside helpers can be scheduled.
+Halide::Func find_func(Halide::Func F, const std::string &name);
@@ -0,0 +1,325 @@
+#include "measures_algorithm.h"
+
+using namespace Halide;
+
+namespace Measures {
+
+Expr unit_float(Expr sample) {
+    Type t = sample.type();
+    if (t.is_float()) {
+        return cast<float>(sample);
+    }
+    return cast<float>(sample) / cast<float>(t.max());
+}
+
+WeightStages define_weight(
+  Func input,
+  Expr c_weight,
+  Expr s_weight,
+  Expr e_weight,
+  bool fast_math,
+  const std::string &suffix
+) {
+    Var x("x"), y("y"), c("c");
+    WeightStages stages;
+
+    // Compute luminance for laplacian.
+    Func grayscale("grayscale" + suffix);
+    float lum_weights[3] = {0.299, 0.587, 0.114};
+    grayscale(x, y) = input(x, y, 0) * lum_weights[0] + input(x, y, 1) * lum_weights[1] + input(x, y, 2) * lum_weights[2];
+
+    // Contrast, as in the paper: the absolute response of a Laplacian filter
+    // on the grayscale image, at full resolution. The Laplacian pyramid of
+    // the paper is the blend (Pyramid::blend), not this measure.
+    Func laplacian("laplacian" + suffix);
+    float lap_weights[3][3] = {{0, 1, 0}, {1, -4, 1}, {0, 1, 0}};
+    laplacian(x, y) = cast<float>(lap_weights[0][0] * grayscale(x - 1, y - 1) + lap_weights[0][1] * grayscale(x, y - 1) + lap_weights[0][2] * grayscale(x + 1, y - 1) 
+                                  + lap_weights[1][0] * grayscale(x - 1, y) + lap_weights[1][1] * grayscale(x, y) + lap_weights[1][2] * grayscale(x + 1, y) 
+                                  + lap_weights[2][0] * grayscale(x - 1, y + 1) + lap_weights[2][1] * grayscale(x, y + 1) + lap_weights[2][2] * grayscale(x + 1, y + 1));
+
+    // Compute contrast weight.
+    Func contrast("contrast" + suffix);
+    contrast(x, y) = abs(laplacian(x, y));
+
+    // Now compute saturation weight.
+    Func saturation("saturation" + suffix);
+    {
+        Expr R = input(x, y, 0);
+        Expr G = input(x, y, 1);
+        Expr B = input(x, y, 2);
+        Expr mu = (R + G + B) / 3.f;
+        saturation(x, y) = sqrt((pow(R - mu, 2.f) + pow(G - mu, 2.f) + pow(B - mu, 2.f)) / 3.f);
+    }
+
+    // Now compute exposure weight.
+    Func exposure("exposure" + suffix);
+    Func weight("weight" + suffix);
+    const float sigma = 0.2f; // from paper.
+    if (fast_math) {
+        // The product of the three Gaussians is a single Gaussian of the summed
+        // squared distances, so one float exp replaces three double ones.
+        Func log_exposure("log_exposure" + suffix);
+        {
+            Expr R = input(x, y, 0) - 0.5f;
+            Expr G = input(x, y, 1) - 0.5f;
+            Expr B = input(x, y, 2) - 0.5f;
+            log_exposure(x, y) = (R * R + G * G + B * B) * (-0.5f / (sigma * sigma));
+        }
+        exposure(x, y) = fast_exp(log_exposure(x, y));
+
+        // Evaluate the product of powers in the log domain. The measures are
+        // clamped away from zero so the logs stay finite (a zero measure still
+        // gives a weight of ~0, or exactly 1 for a zero exponent), and the sum
+        // is clamped to the range fast_exp is valid on.
+        Expr log_c = fast_log(max(contrast(x, y), 1e-20f));
+        Expr log_s = fast_log(max(saturation(x, y), 1e-20f));
+        Expr log_e = log_exposure(x, y);
+        weight(x, y) = fast_exp(max(c_weight * log_c + s_weight * log_s + e_weight * log_e, -87.f));
+    } else {
+        Expr R = exp(cast<double>(-0.5f * pow(input(x, y, 0) - 0.5f, 2)) / std::pow(sigma, 2.f));
+        Expr G = exp(cast<double>(-0.5f * pow(input(x, y, 1) - 0.5f, 2)) / std::pow(sigma, 2.f));
+        Expr B = exp(cast<double>(-0.5f * pow(input(x, y, 2) - 0.5f, 2)) / std::pow(sigma, 2.f));
+        exposure(x, y) = cast<float>(R * G * B);
+
+        weight(x, y) = pow(contrast(x, y), c_weight) * pow(saturation(x, y), s_weight) * pow(exposure(x, y), e_weight);
+    }
+
+    stages.grayscale = grayscale;
+    stages.laplacian = laplacian;
+    stages.contrast = contrast;
+    stages.saturation = saturation;
+    stages.exposure = exposure;
+    stages.weight = weight;
+    return stages;
+}
+
+void schedule_weight_root(WeightStages &stages) {
+    stages.grayscale.compute_root();
+    stages.laplacian.compute_root();
+    stages.contrast.compute_root();
+    stages.saturation.compute_root();
+    stages.exposure.compute_root();
+    stages.weight.compute_root();
+}
+
+void schedule_weight_tiled(WeightStages &stages, Func output) {
+    Var x("x"), y("y"), xo("xo"), yo("yo"), xi("xi"), yi("yi");
+
+    // Guard the tiles rather than shifting them inwards, so images smaller
+    // than a tile still work; loop partitioning keeps inner tiles unguarded.
+    output.tile(x, y, xo, yo, xi, yi, weight_tile_width, weight_tile_height, TailStrategy::GuardWithIf)
+          .parallel(yo)
+          .vectorize(xi, 8);
+
+    // The laplacian reads grayscale at a one pixel halo, so compute it once
+    // per tile instead of inlining it nine times into every output pixel.
+    stages.grayscale.compute_at(output, xo)
+                    .vectorize(x, 8);
+
+    // laplacian, contrast, saturation, exposure and weight are left inline:
+    // they only read their producers at the same pixel.
+}
+
+void schedule_weight_outputs(WeightStages &stages, const std::vector<Func> &outputs, bool grayscale_output) {
+    Var x("x"), y("y"), xo("xo"), yo("yo"), xi("xi"), yi("yi");
+
+    auto is_output = [&](Func f) {
+        for (const Func &output : outputs) {
+            if (output.name() == f.name()) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for (Func output : outputs) {
+        output.compute_root()
+              .tile(x, y, xo, yo, xi, yi, weight_tile_width, weight_tile_height, TailStrategy::GuardWithIf)
+              .parallel(yo)
+              .vectorize(xi, 8);
+    }
+
+    // A grayscale output and the laplacian both read grayscale, so it is
+    // computed once at root. Otherwise it is computed per tile of the first
+    // stage materialized downstream of it, like in schedule_weight_tiled.
+    if (grayscale_output) {
+        stages.grayscale.compute_root()
+                        .parallel(y)
+                        .vectorize(x, 8);
+        return;
+    }
+    for (Func consumer : {stages.laplacian, stages.contrast, stages.weight}) {
+        if (is_output(consumer)) {
+            stages.grayscale.compute_at(consumer, xo)
+                            .vectorize(x, 8);
+            return;
+        }
+    }
+}
+
+BracketStages define_bracket(
+  const std::vector<Func> &inputs,
+  Expr c_weight,
+  Expr s_weight,
+  Expr e_weight,
+  bool fast_math
+) {
+    Var x("x"), y("y"), n("n");
+    BracketStages stages;
+
+    // Each exposure gets its own stages, named apart by its index.
+    std::vector<Expr> weights;
+    Expr sum = 0.f;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        stages.measures.push_back(define_weight(inputs[i], c_weight, s_weight, e_weight, fast_math,
+                                                "_" + std::to_string(i)));
+        weights.push_back(stages.measures.back().weight(x, y));
+        sum += weights.back();
+    }
+
+    Func sum_weights("sum_weights");
+    sum_weights(x, y) = sum;
+
+    Func normalize_weights("normalize_weights");
+    normalize_weights(x, y) = 1.f / sum_weights(x, y);
+
+    Func normalized("normalized");
+    normalized(x, y, n) = mux(n, weights) * normalize_weights(x, y);
+
+    stages.sum_weights = sum_weights;
+    stages.normalize_weights = normalize_weights;
+    stages.normalized = normalized;
+    return stages;
+}
+
+void schedule_bracket(BracketStages &stages, Func output) {
+    Var x("x"), y("y"), n("n"), xo("xo"), yo("yo"), xi("xi"), yi("yi");
+
+    // Keep the exposures inside the tile loop, unrolled so each copy of the
+    // tile loop reads the weights of one exposure only.
+    output.bound(n, 0, (int) stages.measures.size())
+          .tile(x, y, xo, yo, xi, yi, weight_tile_width, weight_tile_height, TailStrategy::GuardWithIf)
+          .reorder(xi, yi, n, xo, yo)
+          .parallel(yo)
+          .vectorize(xi, 8)
+          .unroll(n);
+
+    // The raw weights of a tile are read twice, by the sum and by the
+    // normalization, so every exposure's are computed once per tile, from a
+    // tile of its grayscale, and summed while they are in cache.
+    for (WeightStages &measures : stages.measures) {
+        measures.grayscale.compute_at(output, xo)
+                          .vectorize(x, 8);
+        measures.weight.compute_at(output, xo)
+                       .vectorize(x, 8);
+    }
+    stages.normalize_weights.compute_at(output, xo)
+                            .vectorize(x, 8);
+}
+
+Func define_log_measures(const WeightStages &stages) {
+    Var x("x"), y("y"), m("m");
+
+    Func log_measures("log_measures");
+    log_measures(x, y, m) = mux(m, {log(max(stages.contrast(x, y), 1e-20f)),
+                                    log(max(stages.saturation(x, y), 1e-20f)),
+                                    log(max(stages.exposure(x, y), 1e-20f))});
+    return log_measures;
+}
+
+void schedule_log_measures(WeightStages &stages, Func output) {
+    Var x("x"), y("y"), m("m");
+
+    // The three measures of a pixel share their inputs, so compute them
+    // together; the rest is scheduled like the weight.
+    output.bound(m, 0, 3)
+          .reorder(m, x, y)
+          .unroll(m);
+    schedule_weight_tiled(stages, output);
+}
+
+RetuneStages define_retune(
+  Func log_measures,
+  Expr frames,
+  Expr c_weight,
+  Expr s_weight,
+  Expr e_weight
+) {
+    Var x("x"), y("y"), n("n");
+    RDom r(0, frames, "r");
+    RetuneStages stages;
+
+    // One exp per weight instead of the three pows of define_weight,
+    // clamped to the range of a float like the fast-math weight.
+    Func weight("weight");
+    weight(x, y, n) = exp(max(c_weight * log_measures(x, y, 0, n) + s_weight * log_measures(x, y, 1, n) +
+                              e_weight * log_measures(x, y, 2, n), -87.f));
+
+    Func sum_weights("sum_weights");
+    {
+      sum_weights(x, y) = 0.f;
+      sum_weights(x, y) += weight(x, y, r);
+    }
+
+    Func normalize_weights("normalize_weights");
+    normalize_weights(x, y) = 1.f / sum_weights(x, y);
+
+    Func normalized("normalized");
+    normalized(x, y, n) = weight(x, y, n) * normalize_weights(x, y);
+
+    stages.weight = weight;
+    stages.sum_weights = sum_weights;
+    stages.normalize_weights = normalize_weights;
+    stages.normalized = normalized;
+    return stages;
+}
+
+void schedule_retune(RetuneStages &stages, Func output, Func blend) {
+    Var x("x"), y("y"), c("c"), n("n"), xo("xo"), yo("yo"), xi("xi"), yi("yi");
+
+    if (blend.defined()) {
+        // Keep the channels inside the tile loop, so the weights of a tile,
+        // computed once at xo, serve all of its channels.
+        output.tile(x, y, xo, yo, xi, yi, weight_tile_width, weight_tile_height, TailStrategy::GuardWithIf)
+              .reorder(xi, yi, c, xo, yo)
+              .parallel(yo)
+              .vectorize(xi, 8);
+
+        // The channels of a tile are blended while its weights are in cache.
+        blend.compute_at(output, xo)
+             .vectorize(x, 8);
+        blend.update()
+             .vectorize(x, 8);
+        stages.normalize_weights.compute_at(output, xo)
+                                .vectorize(x, 8);
+    } else {
+        output.tile(x, y, xo, yo, xi, yi, weight_tile_width, weight_tile_height, TailStrategy::GuardWithIf)
+              .reorder(xi, yi, n, xo, yo)
+              .parallel(yo)
+              .vectorize(xi, 8);
+    }
+
+    // The weights are read twice, by the sum and by the normalization.
+    stages.weight.compute_at(output, xo)
+                 .vectorize(x, 8);
+    stages.sum_weights.compute_at(output, xo)
+                      .vectorize(x, 8);
+    stages.sum_weights.update()
+                      .vectorize(x, 8);
+}
+
+Func define_blend(
+  Func in,
+  Func normalized,
+  Expr frames
+) {
+    Var x("x"), y("y"), c("c");
+    RDom n(0, frames, "n");
+
+    Func blend("blend");
+    blend(x, y, c) = 0.f;
+    blend(x, y, c) += in(x, y, c, n) * normalized(x, y, n);
+    return blend;
+}
+
+} // namespace Measures
@@ -0,0 +1,96 @@
+#include "progressive_fusion.h"
+#include "pyramid.h"
+#include <algorithm>
+#include <stdexcept>
+#include <timing.h>
+
+namespace Measures {
+
+// The number of levels of the pyramid of a bracket, checked to have an
+// exposure before the constructor reads the first one.
+static int bracket_levels(const std::vector<Buffer<float>> &in) {
+    if (in.empty()) {
+        throw std::invalid_argument("ProgressiveFusion needs at least one exposure");
+    }
+    return Pyramid::levels(in[0].width(), in[0].height());
+}
+
+ProgressiveFusion::ProgressiveFusion(
+  const std::vector<Buffer<float>> &in,
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  Math math
+) : in(in), c_weight(c_weight), s_weight(s_weight), e_weight(e_weight), math(math),
+    num_levels(bracket_levels(in)), current(num_levels) {
+    widths = {in[0].width()};
+    heights = {in[0].height()};
+    for (int j = 1; j < num_levels; j++) {
+        widths.push_back(Pyramid::coarser(widths.back()));
+        heights.push_back(Pyramid::coarser(heights.back()));
+    }
+}
+
+void ProgressiveFusion::step() {
+    int k = current - 1;
+    bool top = k == num_levels - 1;
+
+    std::vector<Buffer<float>> frames;
+    if (k == 0) {
+        frames = in;
+    } else {
+        for (const Buffer<float> &frame : in) {
+            Buffer<> level = Buffer<float>(widths[k], heights[k], frame.channels());
+            Pyramid::reduce_level(frame, level, 1 << k);
+            frames.push_back(level.as<float>());
+        }
+    }
+    Buffer<float> weights = compute_bracket(frames, c_weight, s_weight, e_weight, math);
+
+    // The blended Laplacian level, or the blended Gaussian level at the top.
+    Buffer<> fused = Buffer<float>(frames[0].width(), frames[0].height(), frames[0].channels());
+    fused.as<float>().fill(0.f);
+    for (size_t i = 0; i < frames.size(); i++) {
+        Buffer<> weight = weights.sliced(2, i).embedded(2);
+        if (top) {
+            Pyramid::accumulate_top(fused, frames[i], weight);
+        } else {
+            Pyramid::accumulate_level(fused, frames[i], coarse[i], weight);
+        }
+    }
+
+    if (!top) {
+        Pyramid::collapse_level(fused, fusion, fused);
+    }
+
+    // Level k + 1 was only needed for the detail of level k.
+    coarse = k > 0 ? frames : std::vector<Buffer<float>>();
+    fusion = fused.as<float>();
+    current = k;
+}
+
+Buffer<float> ProgressiveFusion::refine(double budget_ms) {
+    if (finished()) {
+        return fusion;
+    }
+
+    uint64_t start = nanosecond_timer();
+    while (true) {
+        uint64_t s = nanosecond_timer();
+        step();
+        double step_ms = (nanosecond_timer() - s) / 1e6;
+        if (finished()) {
+            break;
+        }
+
+        // The next level has about four times the pixels of this one.
+        double expected_ms = step_ms * ((double) widths[current - 1] * heights[current - 1]) /
+                             ((double) widths[current] * heights[current]);
+        if ((nanosecond_timer() - start) / 1e6 + expected_ms > budget_ms) {
+            break;
+        }
+    }
+    return fusion;
+}
+
+} // namespace Measures
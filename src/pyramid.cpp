@@ -0,0 +1,441 @@
+#include "pyramid.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <timing.h>
+
+// Ahead-of-time level kernels, generated from generators/pyramid_generator.cpp
+// by the Makefile.
+#include "pyramid_downsample_c1_ff.h"
+#include "pyramid_downsample_c1_fh.h"
+#include "pyramid_downsample_c1_hh.h"
+#include "pyramid_downsample_c3_ff.h"
+#include "pyramid_downsample_c3_fh.h"
+#include "pyramid_downsample_c3_hh.h"
+#include "pyramid_downsample_cn_ff.h"
+#include "pyramid_downsample_cn_fh.h"
+#include "pyramid_downsample_cn_hh.h"
+#include "pyramid_reduce_c3_ff.h"
+#include "pyramid_reduce_cn_ff.h"
+#include "pyramid_accumulate_c3_fffff.h"
+#include "pyramid_accumulate_c3_hfhfh.h"
+#include "pyramid_accumulate_c3_hhhhh.h"
+#include "pyramid_accumulate_cn_fffff.h"
+#include "pyramid_accumulate_cn_hfhfh.h"
+#include "pyramid_accumulate_cn_hhhhh.h"
+#include "pyramid_accumulate_top_c3_ffff.h"
+#include "pyramid_accumulate_top_c3_hffh.h"
+#include "pyramid_accumulate_top_c3_hhhh.h"
+#include "pyramid_accumulate_top_cn_ffff.h"
+#include "pyramid_accumulate_top_cn_hffh.h"
+#include "pyramid_accumulate_top_cn_hhhh.h"
+#include "pyramid_collapse_c3_fff.h"
+#include "pyramid_collapse_c3_hhh.h"
+#include "pyramid_collapse_c3_hhf.h"
+#include "pyramid_collapse_cn_fff.h"
+#include "pyramid_collapse_cn_hhh.h"
+#include "pyramid_collapse_cn_hhf.h"
+#include "pyramid_add_c1_fff.h"
+#include "pyramid_add_cn_fff.h"
+#include "pyramid_normalize_c3_fff.h"
+#include "pyramid_normalize_cn_fff.h"
+#include "pyramid_convert_c3_ff.h"
+#include "pyramid_convert_c3_hf.h"
+#include "pyramid_convert_cn_ff.h"
+#include "pyramid_convert_cn_hf.h"
+
+namespace Pyramid {
+
+int levels(int width, int height) {
+    return std::max(1, (int) log2(std::min(width, height)) - 1);
+}
+
+typedef int (*Kernel1)(halide_buffer_t *, halide_buffer_t *);
+typedef int (*Kernel2)(halide_buffer_t *, halide_buffer_t *, halide_buffer_t *);
+typedef int (*Kernel3)(halide_buffer_t *, halide_buffer_t *, halide_buffer_t *, halide_buffer_t *);
+typedef int (*Kernel4)(halide_buffer_t *, halide_buffer_t *, halide_buffer_t *, halide_buffer_t *, halide_buffer_t *);
+typedef int (*ReduceKernel)(halide_buffer_t *, int, halide_buffer_t *);
+
+// The builds of each kernel, by channel count and level types as the
+// Makefile names them.
+static const std::map<std::string, Kernel1> downsample_kernels = {
+    {"c1_ff", pyramid_downsample_c1_ff}, {"c1_fh", pyramid_downsample_c1_fh}, {"c1_hh", pyramid_downsample_c1_hh},
+    {"c3_ff", pyramid_downsample_c3_ff}, {"c3_fh", pyramid_downsample_c3_fh}, {"c3_hh", pyramid_downsample_c3_hh},
+    {"cn_ff", pyramid_downsample_cn_ff}, {"cn_fh", pyramid_downsample_cn_fh}, {"cn_hh", pyramid_downsample_cn_hh},
+};
+static const std::map<std::string, ReduceKernel> reduce_kernels = {
+    {"c3_ff", pyramid_reduce_c3_ff}, {"cn_ff", pyramid_reduce_cn_ff},
+};
+static const std::map<std::string, Kernel4> accumulate_kernels = {
+    {"c3_fffff", pyramid_accumulate_c3_fffff}, {"c3_hfhfh", pyramid_accumulate_c3_hfhfh}, {"c3_hhhhh", pyramid_accumulate_c3_hhhhh},
+    {"cn_fffff", pyramid_accumulate_cn_fffff}, {"cn_hfhfh", pyramid_accumulate_cn_hfhfh}, {"cn_hhhhh", pyramid_accumulate_cn_hhhhh},
+};
+static const std::map<std::string, Kernel3> accumulate_top_kernels = {
+    {"c3_ffff", pyramid_accumulate_top_c3_ffff}, {"c3_hffh", pyramid_accumulate_top_c3_hffh}, {"c3_hhhh", pyramid_accumulate_top_c3_hhhh},
+    {"cn_ffff", pyramid_accumulate_top_cn_ffff}, {"cn_hffh", pyramid_accumulate_top_cn_hffh}, {"cn_hhhh", pyramid_accumulate_top_cn_hhhh},
+};
+static const std::map<std::string, Kernel2> collapse_kernels = {
+    {"c3_fff", pyramid_collapse_c3_fff}, {"c3_hhh", pyramid_collapse_c3_hhh}, {"c3_hhf", pyramid_collapse_c3_hhf},
+    {"cn_fff", pyramid_collapse_cn_fff}, {"cn_hhh", pyramid_collapse_cn_hhh}, {"cn_hhf", pyramid_collapse_cn_hhf},
+};
+static const std::map<std::string, Kernel2> add_kernels = {
+    {"c1_fff", pyramid_add_c1_fff}, {"cn_fff", pyramid_add_cn_fff},
+};
+static const std::map<std::string, Kernel2> normalize_kernels = {
+    {"c3_fff", pyramid_normalize_c3_fff}, {"cn_fff", pyramid_normalize_cn_fff},
+};
+static const std::map<std::string, Kernel1> convert_kernels = {
+    {"c3_ff", pyramid_convert_c3_ff}, {"c3_hf", pyramid_convert_c3_hf},
+    {"cn_ff", pyramid_convert_cn_ff}, {"cn_hf", pyramid_convert_cn_hf},
+};
+
+// Picks the build of kernel name for buffers, its arguments in order with
+// the output last: the one unrolled over the output's channels if there is
+// one, else the one for any channel count.
+template<typename Kernel>
+static Kernel find_kernel(const char *name, const std::map<std::string, Kernel> &kernels, const std::vector<const Buffer<> *> &buffers) {
+    std::string types = "_";
+    for (const Buffer<> *buffer : buffers) {
+        types += buffer->type() == float16_type ? 'h' : 'f';
+    }
+    int channels = buffers.back()->channels();
+    auto kernel = kernels.find("c" + std::to_string(channels) + types);
+    if (kernel == kernels.end()) {
+        kernel = kernels.find("cn" + types);
+    }
+    if (kernel == kernels.end()) {
+        std::cerr << "[" << name << "] no build for level types " << types.substr(1) << std::endl;
+        exit(-1);
+    }
+    return kernel->second;
+}
+
+// The halide_buffer_t of buffer for a kernel, which takes its inputs as
+// non-const pointers but only reads them.
+static halide_buffer_t *raw(const Buffer<> &buffer) {
+    return const_cast<halide_buffer_t *>(buffer.raw_buffer());
+}
+
+static void check_kernel(int error, const char *name) {
+    if (error != 0) {
+        std::cerr << "[" << name << "] pipeline failed with error " << error << std::endl;
+        exit(-1);
+    }
+}
+
+void downsample_level(const Buffer<> &in, Buffer<> &out) {
+    Kernel1 kernel = find_kernel("pyramid_downsample", downsample_kernels, {&in, &out});
+    check_kernel(kernel(raw(in), raw(out)), "pyramid_downsample");
+}
+
+void accumulate_level(Buffer<> &acc, const Buffer<> &fine, const Buffer<> &coarse, const Buffer<> &weight) {
+    Kernel4 kernel = find_kernel("pyramid_accumulate", accumulate_kernels, {&acc, &fine, &coarse, &weight, &acc});
+    check_kernel(kernel(raw(acc), raw(fine), raw(coarse), raw(weight), raw(acc)),
+                 "pyramid_accumulate");
+}
+
+void accumulate_top(Buffer<> &acc, const Buffer<> &fine, const Buffer<> &weight) {
+    Kernel3 kernel = find_kernel("pyramid_accumulate_top", accumulate_top_kernels, {&acc, &fine, &weight, &acc});
+    check_kernel(kernel(raw(acc), raw(fine), raw(weight), raw(acc)), "pyramid_accumulate_top");
+}
+
+void collapse_level(const Buffer<> &level, const Buffer<> &coarse, Buffer<> &out) {
+    Kernel2 kernel = find_kernel("pyramid_collapse", collapse_kernels, {&level, &coarse, &out});
+    check_kernel(kernel(raw(level), raw(coarse), raw(out)), "pyramid_collapse");
+}
+
+void add_level(Buffer<> &acc, const Buffer<> &level) {
+    Kernel2 kernel = find_kernel("pyramid_add", add_kernels, {&acc, &level, &acc});
+    check_kernel(kernel(raw(acc), raw(level), raw(acc)), "pyramid_add");
+}
+
+void normalize_level(Buffer<> &level, const Buffer<> &weight_sum) {
+    Kernel2 kernel = find_kernel("pyramid_normalize", normalize_kernels, {&level, &weight_sum, &level});
+    check_kernel(kernel(raw(level), raw(weight_sum), raw(level)), "pyramid_normalize");
+}
+
+void reduce_level(const Buffer<> &in, Buffer<> &out, int factor) {
+    ReduceKernel kernel = find_kernel("pyramid_reduce", reduce_kernels, {&in, &out});
+    check_kernel(kernel(raw(in), factor, raw(out)), "pyramid_reduce");
+}
+
+// out = level, converted to the type of out.
+static void convert_level(const Buffer<> &level, Buffer<> &out) {
+    Kernel1 kernel = find_kernel("pyramid_convert", convert_kernels, {&level, &out});
+    check_kernel(kernel(raw(level), raw(out)), "pyramid_convert");
+}
+
+// Sets every sample of a float or float16 level to zero.
+static void clear_level(Buffer<> &level) {
+    if (level.type() == float16_type) {
+        // A float16 zero is all zero bits.
+        Buffer<uint16_t>((uint16_t *) level.data(), level.dimensions(), level.raw_buffer()->dim).fill(0);
+    } else {
+        level.as<float>().fill(0.f);
+    }
+}
+
+static size_t size_in_bytes(const Buffer<> &buffer) {
+    return (size_t) buffer.width() * buffer.height() * buffer.channels() * buffer.type().bytes();
+}
+
+LevelPool::LevelPool(bool reuse) : reuse(reuse) {}
+
+Buffer<> LevelPool::acquire(int width, int height, int channels, halide_type_t type) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Recycle the smallest free buffer the level fits in.
+    Entry *best = nullptr;
+    for (Entry &entry : entries) {
+        if (entry.in_use || entry.buffer.type() != type || entry.buffer.channels() != channels ||
+            entry.buffer.width() < width || entry.buffer.height() < height) {
+            continue;
+        }
+        if (!best || size_in_bytes(entry.buffer) < size_in_bytes(best->buffer)) {
+            best = &entry;
+        }
+    }
+
+    if (!best) {
+        entries.push_back({Buffer<>(type, width, height, channels), false});
+        best = &entries.back();
+
+        counters.allocations++;
+        counters.bytes += size_in_bytes(best->buffer);
+        counters.peak_bytes = std::max(counters.peak_bytes, counters.bytes);
+    }
+
+    best->in_use = true;
+    return best->buffer.cropped(0, 0, width).cropped(1, 0, height);
+}
+
+void LevelPool::release(const Buffer<> &level) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        // Levels are crops at the origin, so they share their buffer's data.
+        if (entries[i].buffer.data() != level.data()) {
+            continue;
+        }
+        if (reuse) {
+            entries[i].in_use = false;
+        } else {
+            counters.bytes -= size_in_bytes(entries[i].buffer);
+            entries.erase(entries.begin() + i);
+        }
+        return;
+    }
+}
+
+LevelPool::Stats LevelPool::stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
+
+void LevelPool::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (size_t i = entries.size(); i-- > 0;) {
+        if (!entries[i].in_use) {
+            counters.bytes -= size_in_bytes(entries[i].buffer);
+            entries.erase(entries.begin() + i);
+        }
+    }
+}
+
+Buffer<float> blend(
+  const std::vector<Buffer<float>> &in,
+  const Buffer<float> &normalized_weights,
+  int num_levels,
+  LevelPool *pool,
+  Measures::Report *report,
+  halide_type_t storage
+) {
+    assert(storage == halide_type_of<float>() || storage == float16_type);
+
+    static LevelPool default_pool;
+    if (!pool) {
+        pool = &default_pool;
+    }
+
+    // Levels held by this blend, for the peak memory of the report.
+    size_t live_bytes = 0;
+    auto acquire = [&](int w, int h, int c) {
+        Buffer<> level = pool->acquire(w, h, c, storage);
+        live_bytes += size_in_bytes(level);
+        if (report) {
+            report->peak_bytes = std::max(report->peak_bytes, live_bytes);
+        }
+        return level;
+    };
+    auto release = [&](const Buffer<> &level) {
+        live_bytes -= size_in_bytes(level);
+        pool->release(level);
+    };
+
+    // Runs a kernel writing out at level, timing it into the report.
+    auto run = [&](const char *kernel, int level, const Buffer<> &out, const std::function<void()> &f) {
+        if (!report) {
+            f();
+            return;
+        }
+        uint64_t s = nanosecond_timer();
+        f();
+        Measures::add_stage(*report, std::string(kernel) + "[" + std::to_string(level) + "]",
+                            (nanosecond_timer() - s) / 1e6, size_in_bytes(out));
+    };
+
+    int width = in[0].width(), height = in[0].height(), channels = in[0].channels();
+    if (num_levels <= 0) {
+        num_levels = levels(width, height);
+    }
+
+    std::vector<int> widths = {width}, heights = {height};
+    for (int j = 1; j < num_levels; j++) {
+        widths.push_back(coarser(widths.back()));
+        heights.push_back(coarser(heights.back()));
+    }
+
+    // The blended Laplacian pyramid, accumulated one exposure at a time.
+    std::vector<Buffer<>> blended;
+    for (int j = 0; j < num_levels; j++) {
+        Buffer<> level = acquire(widths[j], heights[j], channels);
+        clear_level(level);
+        blended.push_back(level);
+    }
+
+    for (size_t i = 0; i < in.size(); i++) {
+        // Walk down the Gaussian pyramids of the exposure and of its weight.
+        // A level is released as soon as its contribution to the blend is
+        // accumulated, so only two levels of each are alive at a time. Level
+        // 0 belongs to the caller.
+        Buffer<> gaussian = in[i];
+        Buffer<> weight = normalized_weights.sliced(2, i).embedded(2);
+        for (int j = 0; j < num_levels - 1; j++) {
+            Buffer<> next_gaussian = acquire(widths[j + 1], heights[j + 1], channels);
+            run("downsample", j + 1, next_gaussian, [&]() { downsample_level(gaussian, next_gaussian); });
+            Buffer<> next_weight = acquire(widths[j + 1], heights[j + 1], 1);
+            run("downsample", j + 1, next_weight, [&]() { downsample_level(weight, next_weight); });
+
+            run("accumulate", j, blended[j], [&]() { accumulate_level(blended[j], gaussian, next_gaussian, weight); });
+
+            if (j > 0) {
+                release(gaussian);
+                release(weight);
+            }
+            gaussian = next_gaussian;
+            weight = next_weight;
+        }
+        run("accumulate", num_levels - 1, blended[num_levels - 1], [&]() {
+            accumulate_top(blended[num_levels - 1], gaussian, weight);
+        });
+
+        if (num_levels > 1) {
+            release(gaussian);
+            release(weight);
+        }
+    }
+
+    // Collapse the blended pyramid in place from the top, and the last level
+    // into the result, which is the only buffer that outlives the call.
+    Buffer<> result = Buffer<float>(width, height, channels);
+    live_bytes += size_in_bytes(result);
+    if (report) {
+        report->peak_bytes = std::max(report->peak_bytes, live_bytes);
+    }
+    if (num_levels == 1) {
+        run("convert", 0, result, [&]() { convert_level(blended[0], result); });
+    } else {
+        for (int j = num_levels - 2; j > 0; j--) {
+            run("collapse", j, blended[j], [&]() { collapse_level(blended[j], blended[j + 1], blended[j]); });
+        }
+        run("collapse", 0, result, [&]() { collapse_level(blended[0], blended[1], result); });
+    }
+
+    for (const Buffer<> &level : blended) {
+        release(level);
+    }
+    return result.as<float>();
+}
+
+Accumulator::Accumulator(int levels, LevelPool *pool) : requested_levels(levels), pool(pool ? pool : &own_pool) {}
+
+void Accumulator::add(const Buffer<float> &image, const Buffer<float> &weight) {
+    int channels = image.channels();
+    if (images == 0) {
+        num_levels = requested_levels > 0 ? requested_levels : levels(image.width(), image.height());
+        widths = {image.width()};
+        heights = {image.height()};
+        for (int j = 1; j < num_levels; j++) {
+            widths.push_back(coarser(widths.back()));
+            heights.push_back(coarser(heights.back()));
+        }
+
+        for (int j = 0; j < num_levels; j++) {
+            blended.push_back(pool->acquire(widths[j], heights[j], channels));
+            clear_level(blended.back());
+            weight_sums.push_back(pool->acquire(widths[j], heights[j], 1));
+            clear_level(weight_sums.back());
+        }
+    }
+    assert(image.width() == widths[0] && image.height() == heights[0] && channels == blended[0].channels());
+
+    // Walk down the Gaussian pyramids of the image and of its weight like
+    // blend does, adding each level's contribution to both sums.
+    Buffer<> gaussian = image;
+    Buffer<> w = weight.dimensions() == 2 ? weight.embedded(2) : weight;
+    for (int j = 0; j < num_levels - 1; j++) {
+        Buffer<> next_gaussian = pool->acquire(widths[j + 1], heights[j + 1], channels);
+        downsample_level(gaussian, next_gaussian);
+        Buffer<> next_weight = pool->acquire(widths[j + 1], heights[j + 1], 1);
+        downsample_level(w, next_weight);
+
+        accumulate_level(blended[j], gaussian, next_gaussian, w);
+        add_level(weight_sums[j], w);
+
+        if (j > 0) {
+            pool->release(gaussian);
+            pool->release(w);
+        }
+        gaussian = next_gaussian;
+        w = next_weight;
+    }
+    accumulate_top(blended[num_levels - 1], gaussian, w);
+    add_level(weight_sums[num_levels - 1], w);
+
+    if (num_levels > 1) {
+        pool->release(gaussian);
+        pool->release(w);
+    }
+    images++;
+}
+
+Buffer<float> Accumulator::finish() {
+    assert(images > 0);
+
+    for (int j = 0; j < num_levels; j++) {
+        normalize_level(blended[j], weight_sums[j]);
+    }
+
+    Buffer<> result = Buffer<float>(widths[0], heights[0], blended[0].channels());
+    if (num_levels == 1) {
+        convert_level(blended[0], result);
+    } else {
+        for (int j = num_levels - 2; j > 0; j--) {
+            collapse_level(blended[j], blended[j + 1], blended[j]);
+        }
+        collapse_level(blended[0], blended[1], result);
+    }
+
+    for (int j = 0; j < num_levels; j++) {
+        pool->release(blended[j]);
+        pool->release(weight_sums[j]);
+    }
+    blended.clear();
+    weight_sums.clear();
+    images = 0;
+    return result.as<float>();
+}
+
+} // namespace Pyramid
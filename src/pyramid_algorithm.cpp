@@ -0,0 +1,59 @@
+#include "pyramid_algorithm.h"
+
+using namespace Halide;
+
+namespace Pyramid {
+
+Func upsample(Func input)
+{
+  // Use bilinear interpolation to upsample an image.
+  Func upx("upx"), upy("upy");
+  Var x("x"), y("y");
+
+  upx(x, y, _) = lerp(input((x + 1) / 2, y, _), input((x - 1) / 2, y, _), ((x % 2) * 2 + 1) / 4.f);
+  upy(x, y, _) = lerp(upx(x, (y + 1) / 2, _), upx(x, (y - 1) / 2, _), ((y % 2) * 2 + 1) / 4.f);
+
+  return upy;
+}
+
+Func downsample(Func input)
+{
+  // Downsample with [1, 3, 3, 1] filter
+  Func downx("downx"), downy("downy");
+  Var x("x"), y("y");
+
+  downx(x, y, _) = (input(x * 2 - 1, y, _) + input(x * 2, y, _) * 3 + input(x * 2 + 1, y, _) * 3 + input(x * 2 + 2, y, _)) / 8.f;
+  downy(x, y, _) = (downx(x, y * 2 - 1, _) + downx(x, y * 2, _) * 3 + downx(x, y * 2 + 1, _) * 3 + downx(x, y * 2 + 2, _)) / 8.f;
+
+  return downy;
+}
+
+Func reduce(Func input, Expr factor) {
+    Var x("x"), y("y"), c("c");
+
+    Expr taps = min(factor, reduce_taps), spacing = factor / taps;
+    RDom r(0, taps, 0, taps, "r");
+    Expr sx = x * factor + spacing / 2 + r.x * spacing;
+    Expr sy = y * factor + spacing / 2 + r.y * spacing;
+
+    // Not named reduced, the output of the reduce kernel that calls this.
+    Func block_mean("block_mean");
+    block_mean(x, y, c) = sum(input(sx, sy, c)) / cast<float>(taps * taps);
+    return block_mean;
+}
+
+void schedule_level(Func output, int channels, Expr width, Expr height) {
+    Var x("x"), y("y"), c("c"), yo("yo"), yi("yi");
+
+    output.reorder(c, x, y)
+          .split(y, yo, yi, 8, TailStrategy::GuardWithIf);
+    if (channels > 0) {
+        output.bound(c, 0, channels)
+              .unroll(c);
+    }
+    output.specialize(width >= parallel_extent && height >= parallel_extent)
+          .parallel(yo)
+          .vectorize(x, 8, TailStrategy::GuardWithIf);
+}
+
+} // namespace Pyramid
@@ -1,122 +1,674 @@
 #include "quality_measures.h"
-#include "utils.h"
+#include "measures_schedule.h"
+#include "pyramid.h"
+#include <algorithm>
+#include <limits>
 #include <vector>
+#include <timing.h>
 
-using namespace Halide;
+// Ahead-of-time compiled pipelines, generated from generators/ by the Makefile.
+#include "measures_weight.h"
+#include "measures_weight_root.h"
+#include "measures_weight_fast.h"
+#include "measures_weight_root_fast.h"
+#include "measures_accumulate.h"
+#include "measures_add_weight.h"
+#include "measures_normalize.h"
+#include "measures_normalize_weights.h"
+#include "measures_bracket_1.h"
+#include "measures_bracket_2.h"
+#include "measures_bracket_3.h"
+#include "measures_bracket_4.h"
+#include "measures_bracket_5.h"
+#include "measures_bracket_6.h"
+#include "measures_bracket_7.h"
+#include "measures_bracket_8.h"
+#include "measures_bracket_fast_1.h"
+#include "measures_bracket_fast_2.h"
+#include "measures_bracket_fast_3.h"
+#include "measures_bracket_fast_4.h"
+#include "measures_bracket_fast_5.h"
+#include "measures_bracket_fast_6.h"
+#include "measures_bracket_fast_7.h"
+#include "measures_bracket_fast_8.h"
+#include "measures_weight_profile.h"
+#include "measures_weight_root_profile.h"
+#include "measures_weight_fast_profile.h"
+#include "measures_weight_root_fast_profile.h"
+#include "measures_accumulate_profile.h"
+#include "measures_add_weight_profile.h"
+#include "measures_normalize_profile.h"
+#include "measures_weight_u8.h"
+#include "measures_weight_u16.h"
+#include "measures_weight_fast_u8.h"
+#include "measures_weight_fast_u16.h"
+#include "measures_accumulate_u8.h"
+#include "measures_accumulate_u16.h"
+#include "measures_weight_u8_profile.h"
+#include "measures_weight_u16_profile.h"
+#include "measures_weight_fast_u8_profile.h"
+#include "measures_weight_fast_u16_profile.h"
+#include "measures_accumulate_u8_profile.h"
+#include "measures_accumulate_u16_profile.h"
+#include "measures_intermediates.h"
+#include "measures_intermediates_fast.h"
+#include "measures_intermediates_profile.h"
+#include "measures_intermediates_fast_profile.h"
+#include "measures_log_measures.h"
+#include "measures_retune.h"
+#include "measures_retune_weights.h"
 
 namespace Measures {
 
+// The halide_buffer_t of buffer for an ahead-of-time pipeline, which takes
+// its inputs as non-const pointers but only reads them.
+template<typename T>
+static halide_buffer_t *raw(const Buffer<T> &buffer) {
+    return const_cast<halide_buffer_t *>(buffer.raw_buffer());
+}
+
+// The ahead-of-time pipelines report failures through their return code.
+static void check_pipeline(int error, const char *name) {
+    if (error != 0) {
+        std::cerr << "[" << name << "] pipeline failed with error " << error << std::endl;
+        exit(-1);
+    }
+}
+
+// The samples of an 8 or 16-bit frame as floats in [0, 1], like load<float>
+// gives them, for the paths that have no integer build.
+template<typename T>
+static Buffer<float> to_float(const Buffer<T> &in) {
+    Buffer<float> out(in.width(), in.height(), in.channels());
+    out.for_each_value([](float &o, T i) { o = i / (float) std::numeric_limits<T>::max(); }, in);
+    return out;
+}
+
+typedef int (*WeightPipeline)(halide_buffer_t *, float, float, float, halide_buffer_t *);
+
+// Picks the ahead-of-time weight pipeline compiled for a schedule and math
+// mode, with or without the profiler.
+static WeightPipeline weight_pipeline(Schedule schedule, Math math, bool profiled = false) {
+    if (profiled) {
+        if (schedule == Schedule::Root) {
+            return math == Math::Fast ? measures_weight_root_fast_profile : measures_weight_root_profile;
+        }
+        return math == Math::Fast ? measures_weight_fast_profile : measures_weight_profile;
+    }
+    if (schedule == Schedule::Root) {
+        return math == Math::Fast ? measures_weight_root_fast : measures_weight_root;
+    }
+    return math == Math::Fast ? measures_weight_fast : measures_weight;
+}
+
+// Runs an ahead-of-time pipeline, or its profiled build into report if
+// there is one.
+static void run_pipeline(
+  const char *name,
+  const std::function<int()> &run,
+  const std::function<int()> &run_profiled_build,
+  Report *report
+) {
+    if (!report) {
+        check_pipeline(run(), name);
+        return;
+    }
+    *report = Report();
+    report->pipeline = name;
+    check_pipeline(run_profiled(*report, run_profiled_build), name);
+    finish_report(*report);
+}
+
+// The intermediates in the order they are computed, which is also the
+// order of the outputs of measures_intermediates.
+static const DebugIntermediate intermediate_order[] = {
+    DebugIntermediate::Grayscale,
+    DebugIntermediate::Laplacian,
+    DebugIntermediate::Contrast,
+    DebugIntermediate::Saturation,
+    DebugIntermediate::Exposure,
+    DebugIntermediate::Weight
+};
+
+// None asks for the weight, like it does in compute().
+static DebugIntermediate canonical(DebugIntermediate intermediate) {
+    return intermediate == DebugIntermediate::None ? DebugIntermediate::Weight : intermediate;
+}
+
+typedef int (*IntermediatesPipeline)(halide_buffer_t *, float, float, float, halide_buffer_t *, halide_buffer_t *,
+                                     halide_buffer_t *, halide_buffer_t *, halide_buffer_t *, halide_buffer_t *);
+
+// compute_intermediates, run by the profiled build into report if there is
+// one.
+static std::map<DebugIntermediate, Buffer<float>> run_intermediates(
+  const Buffer<float> &in,
+  const std::vector<DebugIntermediate> &intermediates,
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  Math math,
+  Report *report
+) {
+    assert(!intermediates.empty());
+
+    int requested = 0;
+    for (DebugIntermediate intermediate : intermediates) {
+        requested |= 1 << (int) canonical(intermediate);
+    }
+
+    // Every intermediate is an output of the same pass, so the ones that
+    // weren't asked for are computed too and dropped.
+    std::map<DebugIntermediate, Buffer<float>> outputs;
+    for (DebugIntermediate intermediate : intermediate_order) {
+        outputs[intermediate] = Buffer<float>(in.width(), in.height());
+    }
+    IntermediatesPipeline pipeline = math == Math::Fast ? measures_intermediates_fast : measures_intermediates;
+    IntermediatesPipeline profiled = math == Math::Fast ? measures_intermediates_fast_profile : measures_intermediates_profile;
+    auto run = [&](IntermediatesPipeline p) {
+        return p(raw(in), c_weight, s_weight, e_weight,
+                 raw(outputs[DebugIntermediate::Grayscale]), raw(outputs[DebugIntermediate::Laplacian]),
+                 raw(outputs[DebugIntermediate::Contrast]), raw(outputs[DebugIntermediate::Saturation]),
+                 raw(outputs[DebugIntermediate::Exposure]), raw(outputs[DebugIntermediate::Weight]));
+    };
+    run_pipeline("measures_intermediates", [&]() { return run(pipeline); }, [&]() { return run(profiled); }, report);
+
+    std::map<DebugIntermediate, Buffer<float>> result;
+    for (DebugIntermediate intermediate : intermediate_order) {
+        if (requested & (1 << (int) intermediate)) {
+            result[intermediate] = outputs[intermediate];
+        }
+    }
+    // Callers that asked for None find the weight under None too.
+    if (requested & (1 << (int) DebugIntermediate::Weight)) {
+        result[DebugIntermediate::None] = result[DebugIntermediate::Weight];
+    }
+    return result;
+}
+
 Buffer<float> compute(
   const Buffer<float> &in, 
   float c_weight, 
   float s_weight, 
   float e_weight,
-  DebugIntermediate debug_intermediate
-) {
-    Var x("x"), y("y"), c("c");
-
-    // Clamp the input so bounds inference can infer all the rest (i.e. for laplacian).
-    // This maybe isn't the most optimal thing, but it's the easiest.
-    Func input("input");
-    input(x, y, c) = in(clamp(x, 0, in.width() - 1), clamp(y, 0, in.height() -1), c);
-
-    // Compute luminance for laplacian.
-    Func grayscale("grayscale");
-    float lum_weights[3] = {0.299, 0.587, 0.114};
-    grayscale(x, y) = input(x, y, 0) * lum_weights[0] + input(x, y, 1) * lum_weights[1] + input(x, y, 2) * lum_weights[2];
-
-    // TODO: does the paper say a Laplacian pyramid? This is just the discrete Laplacian operator.
-    Func laplacian("laplacian");
-    float lap_weights[3][3] = {{0, 1, 0}, {1, -4, 1}, {0, 1, 0}};
-    laplacian(x, y) = cast<float>(lap_weights[0][0] * grayscale(x - 1, y - 1) + lap_weights[0][1] * grayscale(x, y - 1) + lap_weights[0][2] * grayscale(x + 1, y - 1) 
-                                  + lap_weights[1][0] * grayscale(x - 1, y) + lap_weights[1][1] * grayscale(x, y) + lap_weights[1][2] * grayscale(x + 1, y) 
-                                  + lap_weights[2][0] * grayscale(x - 1, y + 1) + lap_weights[2][1] * grayscale(x, y + 1) + lap_weights[2][2] * grayscale(x + 1, y + 1));
-
-    // Compute contrast weight.
-    Func contrast("contrast");
-    contrast(x, y) = abs(laplacian(x, y));
-
-    // Now compute saturation weight.
-    Func saturation("saturation");
-    {
-        Expr R = input(x, y, 0);
-        Expr G = input(x, y, 1);
-        Expr B = input(x, y, 2);
-        Expr mu = (R + G + B) / 3.f;
-        saturation(x, y) = sqrt((pow(R - mu, 2.f) + pow(G - mu, 2.f) + pow(B - mu, 2.f)) / 3.f);
-    }
-
-    // Now compute exposure weight.
-    Func exposure("exposure");
-    {
-        const float sigma = 0.2f; // from paper.
-        Expr R = exp(cast<double>(-0.5f * pow(input(x, y, 0) - 0.5f, 2)) / std::pow(sigma, 2.f));
-        Expr G = exp(cast<double>(-0.5f * pow(input(x, y, 1) - 0.5f, 2)) / std::pow(sigma, 2.f));
-        Expr B = exp(cast<double>(-0.5f * pow(input(x, y, 2) - 0.5f, 2)) / std::pow(sigma, 2.f));
-        exposure(x, y) = cast<float>(R * G * B);
-    }
-
-    Func weight("weight");
-
-    switch (debug_intermediate) {
-        case DebugIntermediate::Grayscale:
-            weight = grayscale;
-            break;
-        case DebugIntermediate::Laplacian:
-            weight = laplacian;
-            break;  
-        case DebugIntermediate::Contrast:
-            weight = contrast;
-            break;  
-        case DebugIntermediate::Saturation:
-            weight = saturation;
-            break;  
-        case DebugIntermediate::Exposure: 
-            weight = exposure;
-            break;
-        default:
-            weight(x, y) = pow(contrast(x, y), c_weight) * pow(saturation(x, y), s_weight) * pow(exposure(x, y), e_weight);
-            break;
-    }
-
-    // TODO: actually schedule.
-    apply_auto_schedule(weight);
-
-    return weight.realize({in.width(), in.height()});
+  DebugIntermediate debug_intermediate,
+  Schedule schedule,
+  Math math,
+  Report *report
+) {
+    if (debug_intermediate == DebugIntermediate::None || debug_intermediate == DebugIntermediate::Weight) {
+        // The weight map alone has a pipeline of its own.
+        Buffer<float> weight(in.width(), in.height());
+        WeightPipeline pipeline = weight_pipeline(schedule, math);
+        WeightPipeline profiled = weight_pipeline(schedule, math, true);
+        run_pipeline("measures_weight",
+            [&]() { return pipeline(raw(in), c_weight, s_weight, e_weight, raw(weight)); },
+            [&]() { return profiled(raw(in), c_weight, s_weight, e_weight, raw(weight)); },
+            report);
+        return weight;
+    }
+
+    return run_intermediates(in, {debug_intermediate}, c_weight, s_weight, e_weight, math, report)[debug_intermediate];
+}
+
+// The integer builds of the weight pipeline for one sample type: exact and
+// fast math, each without and with the profiler.
+struct NativeWeightPipelines {
+    WeightPipeline exact, fast, exact_profile, fast_profile;
+};
+
+// compute on integer samples, with the pipelines built for their type. The
+// root schedule and the debug intermediates have no integer builds, so the
+// frame is converted first, and the conversion is a stage of the report.
+template<typename T>
+static Buffer<float> compute_native(
+  const Buffer<T> &in,
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  DebugIntermediate debug_intermediate,
+  Schedule schedule,
+  Math math,
+  Report *report,
+  const NativeWeightPipelines &pipelines
+) {
+    bool weight = debug_intermediate == DebugIntermediate::None || debug_intermediate == DebugIntermediate::Weight;
+    if (!weight || schedule != Schedule::Tiled) {
+        uint64_t s = nanosecond_timer();
+        Buffer<float> frame = to_float(in);
+        double conversion_ms = (nanosecond_timer() - s) / 1e6;
+        Buffer<float> result = compute(frame, c_weight, s_weight, e_weight, debug_intermediate, schedule, math, report);
+        if (report) {
+            add_stage(*report, "to_float", conversion_ms, frame.size_in_bytes());
+            finish_report(*report);
+        }
+        return result;
+    }
+
+    Buffer<float> weight_map(in.width(), in.height());
+    WeightPipeline pipeline = math == Math::Fast ? pipelines.fast : pipelines.exact;
+    WeightPipeline profiled = math == Math::Fast ? pipelines.fast_profile : pipelines.exact_profile;
+    run_pipeline("measures_weight",
+        [&]() { return pipeline(raw(in), c_weight, s_weight, e_weight, raw(weight_map)); },
+        [&]() { return profiled(raw(in), c_weight, s_weight, e_weight, raw(weight_map)); },
+        report);
+    return weight_map;
+}
+
+Buffer<float> compute(
+  const Buffer<uint8_t> &in,
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  DebugIntermediate debug_intermediate,
+  Schedule schedule,
+  Math math,
+  Report *report
+) {
+    return compute_native(in, c_weight, s_weight, e_weight, debug_intermediate, schedule, math, report,
+                          {measures_weight_u8, measures_weight_fast_u8,
+                           measures_weight_u8_profile, measures_weight_fast_u8_profile});
+}
+
+Buffer<float> compute(
+  const Buffer<uint16_t> &in,
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  DebugIntermediate debug_intermediate,
+  Schedule schedule,
+  Math math,
+  Report *report
+) {
+    return compute_native(in, c_weight, s_weight, e_weight, debug_intermediate, schedule, math, report,
+                          {measures_weight_u16, measures_weight_fast_u16,
+                           measures_weight_u16_profile, measures_weight_fast_u16_profile});
+}
+
+std::map<DebugIntermediate, Buffer<float>> compute_intermediates(
+  const Buffer<float> &in,
+  const std::vector<DebugIntermediate> &intermediates,
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  Math math
+) {
+    return run_intermediates(in, intermediates, c_weight, s_weight, e_weight, math, nullptr);
+}
+
+typedef int (*BracketPipeline)(void **);
+
+Buffer<float> compute_bracket(
+  const std::vector<Buffer<float>> &in,
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  Math math
+) {
+    Buffer<float> weights(in[0].width(), in[0].height(), (int) in.size());
+    if (in.size() <= (size_t) bracket_max_frames) {
+        // The build for this many exposures, through its argv entry point,
+        // which takes every argument by address (buffers as themselves).
+        static const BracketPipeline pipelines[2][bracket_max_frames] = {
+            {measures_bracket_1_argv, measures_bracket_2_argv, measures_bracket_3_argv, measures_bracket_4_argv,
+             measures_bracket_5_argv, measures_bracket_6_argv, measures_bracket_7_argv, measures_bracket_8_argv},
+            {measures_bracket_fast_1_argv, measures_bracket_fast_2_argv, measures_bracket_fast_3_argv,
+             measures_bracket_fast_4_argv, measures_bracket_fast_5_argv, measures_bracket_fast_6_argv,
+             measures_bracket_fast_7_argv, measures_bracket_fast_8_argv}
+        };
+        std::vector<void *> args;
+        for (const Buffer<float> &frame : in) {
+            args.push_back(raw(frame));
+        }
+        args.insert(args.end(), {&c_weight, &s_weight, &e_weight, raw(weights)});
+        check_pipeline(pipelines[math == Math::Fast][in.size() - 1](args.data()), "measures_bracket");
+        return weights;
+    }
+
+    // Longer brackets have no build of their own: the weight map of each
+    // exposure is computed into its plane of the result, which is then
+    // normalized in place.
+    WeightPipeline pipeline = weight_pipeline(Schedule::Tiled, math);
+    for (size_t i = 0; i < in.size(); i++) {
+        Buffer<float> weight = weights.sliced(2, i);
+        check_pipeline(pipeline(raw(in[i]), c_weight, s_weight, e_weight, raw(weight)), "measures_weight");
+    }
+    check_pipeline(measures_normalize_weights(raw(weights), raw(weights)), "measures_normalize_weights");
+    return weights;
+}
+
+typedef int (*AccumulatePipeline)(halide_buffer_t *, halide_buffer_t *, halide_buffer_t *, halide_buffer_t *);
+
+// Blends the exposures in into fusion one at a time, so they are read where
+// they are instead of being stacked into one buffer: fusion accumulates each
+// exposure times its weight. Unless the weights are normalized, weight_sum
+// accumulates the weights and divides fusion at the end. Returns the first
+// pipeline error.
+template<typename T>
+static int blend_frames(
+  const std::vector<Buffer<T>> &in,
+  const std::vector<Buffer<float>> &weights,
+  bool normalized,
+  AccumulatePipeline accumulate,
+  bool profiled,
+  Buffer<float> &fusion
+) {
+    fusion.fill(0.f);
+    Buffer<float> weight_sum;
+    if (!normalized) {
+        weight_sum = Buffer<float>(fusion.width(), fusion.height());
+        weight_sum.fill(0.f);
+    }
+
+    for (size_t i = 0; i < in.size(); i++) {
+        int error = accumulate(raw(in[i]), raw(weights[i]), raw(fusion), raw(fusion));
+        if (error == 0 && !normalized) {
+            error = (profiled ? measures_add_weight_profile : measures_add_weight)(
+                raw(weights[i]), raw(weight_sum), raw(weight_sum));
+        }
+        if (error != 0) {
+            return error;
+        }
+    }
+
+    if (normalized) {
+        return 0;
+    }
+    return (profiled ? measures_normalize_profile : measures_normalize)(
+        raw(fusion), raw(weight_sum), raw(fusion));
+}
+
+// The weight maps (x, y) of normalized weights (x, y, n), without copying.
+static std::vector<Buffer<float>> weight_planes(const Buffer<float> &normalized_weights) {
+    std::vector<Buffer<float>> planes;
+    for (int i = 0; i < normalized_weights.dim(2).extent(); i++) {
+        planes.push_back(normalized_weights.sliced(2, i));
+    }
+    return planes;
 }
 
 Buffer<float> compute_fusion(
   const std::vector<Buffer<float>> &in, 
-  const std::vector<Buffer<float>> &weight_maps 
+  const std::vector<Buffer<float>> &weight_maps,
+  Report *report
+) {
+    assert(in.size() == weight_maps.size());
+
+    Buffer<float> fusion(in[0].width(), in[0].height(), in[0].channels());
+    run_pipeline("measures_fusion",
+        [&]() { return blend_frames(in, weight_maps, false, measures_accumulate, false, fusion); },
+        [&]() { return blend_frames(in, weight_maps, false, measures_accumulate_profile, true, fusion); },
+        report);
+    return fusion;
+}
+
+Buffer<float> compute_fusion(
+  const std::vector<Buffer<float>> &in,
+  const Buffer<float> &normalized_weights,
+  Report *report
+) {
+    assert((int) in.size() == normalized_weights.dim(2).extent());
+
+    std::vector<Buffer<float>> weights = weight_planes(normalized_weights);
+    Buffer<float> fusion(in[0].width(), in[0].height(), in[0].channels());
+    run_pipeline("measures_blend",
+        [&]() { return blend_frames(in, weights, true, measures_accumulate, false, fusion); },
+        [&]() { return blend_frames(in, weights, true, measures_accumulate_profile, true, fusion); },
+        report);
+    return fusion;
+}
+
+// compute_fusion on integer exposures, with the accumulate pipeline built
+// for their type.
+template<typename T>
+static Buffer<float> fusion_native(
+  const char *name,
+  const std::vector<Buffer<T>> &in,
+  const std::vector<Buffer<float>> &weights,
+  bool normalized,
+  AccumulatePipeline accumulate,
+  AccumulatePipeline accumulate_profile,
+  Report *report
+) {
+    Buffer<float> fusion(in[0].width(), in[0].height(), in[0].channels());
+    run_pipeline(name,
+        [&]() { return blend_frames(in, weights, normalized, accumulate, false, fusion); },
+        [&]() { return blend_frames(in, weights, normalized, accumulate_profile, true, fusion); },
+        report);
+    return fusion;
+}
+
+Buffer<float> compute_fusion(
+  const std::vector<Buffer<uint8_t>> &in,
+  const std::vector<Buffer<float>> &weight_maps,
+  Report *report
 ) {
     assert(in.size() == weight_maps.size());
+    return fusion_native("measures_fusion", in, weight_maps, false, measures_accumulate_u8,
+                         measures_accumulate_u8_profile, report);
+}
+
+Buffer<float> compute_fusion(
+  const std::vector<Buffer<uint16_t>> &in,
+  const std::vector<Buffer<float>> &weight_maps,
+  Report *report
+) {
+    assert(in.size() == weight_maps.size());
+    return fusion_native("measures_fusion", in, weight_maps, false, measures_accumulate_u16,
+                         measures_accumulate_u16_profile, report);
+}
+
+Buffer<float> compute_fusion(
+  const std::vector<Buffer<uint8_t>> &in,
+  const Buffer<float> &normalized_weights,
+  Report *report
+) {
+    assert((int) in.size() == normalized_weights.dim(2).extent());
+    return fusion_native("measures_blend", in, weight_planes(normalized_weights), true, measures_accumulate_u8,
+                         measures_accumulate_u8_profile, report);
+}
+
+Buffer<float> compute_fusion(
+  const std::vector<Buffer<uint16_t>> &in,
+  const Buffer<float> &normalized_weights,
+  Report *report
+) {
+    assert((int) in.size() == normalized_weights.dim(2).extent());
+    return fusion_native("measures_blend", in, weight_planes(normalized_weights), true, measures_accumulate_u16,
+                         measures_accumulate_u16_profile, report);
+}
+
+Buffer<float> compute_pyramid_fusion(
+  const std::vector<Buffer<float>> &in,
+  const Buffer<float> &normalized_weights,
+  int levels,
+  Report *report,
+  Storage storage
+) {
+    assert((int) in.size() == normalized_weights.dim(2).extent());
+
+    halide_type_t type = storage == Storage::Float16 ? Pyramid::float16_type : halide_type_of<float>();
+    if (!report) {
+        return Pyramid::blend(in, normalized_weights, levels, nullptr, nullptr, type);
+    }
+    *report = Report();
+    report->pipeline = "pyramid_blend";
+    Buffer<float> result = Pyramid::blend(in, normalized_weights, levels, nullptr, report, type);
+    finish_report(*report);
+    return result;
+}
 
-    Var x("x"), y("y"), c("c");
+StorageError storage_error(const Buffer<float> &result, const Buffer<float> &reference) {
+    StorageError error;
+    double squares = 0.0;
+    size_t samples = 0;
+    reference.for_each_element([&](const int *pos) {
+        float difference = std::abs(result(pos) - reference(pos));
+        error.max_error = std::max(error.max_error, difference);
+        squares += (double) difference * difference;
+        samples++;
+    });
 
-    Func normalize_weights("normalize_weights");
-    {
-        Func sum_weights("sum_weights");
-        {
-          sum_weights(x, y) = 0.f;
-          for (size_t i = 0; i < weight_maps.size(); i++) {
-              sum_weights(x, y) += weight_maps[i](x, y);
-          }
+    error.rms_error = (float) std::sqrt(squares / std::max<size_t>(1, samples));
+    error.psnr = error.rms_error > 0.f ? -20.f * std::log10(error.rms_error) : INFINITY;
+    return error;
+}
+
+void compute_fusion_streaming(
+  int width,
+  int height,
+  int channels,
+  int frames,
+  const StripSource &source,
+  const StripSink &sink,
+  int strip_height,
+  float c_weight,
+  float s_weight,
+  float e_weight
+) {
+    // Strips are whole tiles of the weight schedule, so every pixel is
+    // computed by the same code as when the whole image is realized.
+    strip_height = std::max(1, (strip_height + weight_tile_height - 1) / weight_tile_height) * weight_tile_height;
+
+    // Buffers for the largest strip, reused by every strip. Exposures are
+    // added to the running sums one at a time, so only one is held.
+    Buffer<float> frame_buffer(width, strip_height + 2 * weight_halo, channels);
+    Buffer<float> weight_buffer(width, strip_height);
+    Buffer<float> weight_sum_buffer(width, strip_height);
+    Buffer<float> fusion_buffer(width, strip_height, channels);
+
+    for (int y = 0; y < height; y += strip_height) {
+        int rows = std::min(strip_height, height - y);
+
+        // The input rows the stencil reads, clipped to the image: at the
+        // borders the weight pipeline clamps exactly like on the whole image.
+        int in_min = std::max(0, y - weight_halo);
+        int in_max = std::min(height - 1, y + rows - 1 + weight_halo);
+
+        Buffer<float> frame = frame_buffer.cropped(1, 0, in_max - in_min + 1);
+        frame.set_min(0, in_min, 0);
+        Buffer<float> weight = weight_buffer.cropped(1, 0, rows);
+        weight.set_min(0, y);
+        Buffer<float> weight_sum = weight_sum_buffer.cropped(1, 0, rows);
+        weight_sum.set_min(0, y);
+        Buffer<float> strip_fusion = fusion_buffer.cropped(1, 0, rows);
+        strip_fusion.set_min(0, y, 0);
+
+        // The same pipelines, in the same order, as compute_fusion.
+        strip_fusion.fill(0.f);
+        weight_sum.fill(0.f);
+        for (int i = 0; i < frames; i++) {
+            source(i, frame);
+            check_pipeline(measures_weight(raw(frame), c_weight, s_weight, e_weight, raw(weight)), "measures_weight");
+            check_pipeline(measures_accumulate(raw(frame), raw(weight), raw(strip_fusion),
+                                               raw(strip_fusion)), "measures_accumulate");
+            check_pipeline(measures_add_weight(raw(weight), raw(weight_sum), raw(weight_sum)),
+                           "measures_add_weight");
         }
 
-        normalize_weights(x, y) = 1.f / sum_weights(x, y);
+        check_pipeline(measures_normalize(raw(strip_fusion), raw(weight_sum), raw(strip_fusion)),
+                       "measures_normalize");
+        sink(strip_fusion);
+    }
+}
+
+Buffer<float> compute_fusion_streaming(
+  const std::vector<Buffer<float>> &in,
+  int strip_height,
+  float c_weight,
+  float s_weight,
+  float e_weight
+) {
+    Buffer<float> fusion(in[0].width(), in[0].height(), in[0].channels());
+
+    compute_fusion_streaming(
+        in[0].width(), in[0].height(), in[0].channels(), (int) in.size(),
+        [&](int frame, Buffer<float> &strip) { strip.copy_from(in[frame]); },
+        [&](const Buffer<float> &strip) { fusion.copy_from(strip); },
+        strip_height, c_weight, s_weight, e_weight);
+
+    return fusion;
+}
+
+TuningSession::TuningSession(const Buffer<float> &bracket) {
+    set_bracket(bracket);
+}
+
+void TuningSession::set_bracket(const Buffer<float> &bracket) {
+    assert(bracket.dimensions() == 4);
+
+    frames = bracket;
+    log_measures = Buffer<float>(frames.width(), frames.height(), 3, frames.dim(3).extent());
+    stale.assign(frames.dim(3).extent(), true);
+}
+
+void TuningSession::set_frame(int i, const Buffer<float> &frame) {
+    assert(i >= 0 && i < (int) stale.size());
+    assert(frame.width() == frames.width() && frame.height() == frames.height() && frame.channels() == frames.channels());
+
+    Buffer<float> plane = frames.sliced(3, i);
+    if (frame.data() != plane.data()) {
+        plane.copy_from(frame);
     }
+    stale[i] = true;
+}
 
-    Func fusion("fusion");
-    {
-        fusion(x, y, c) = 0.f;
-        for (size_t i = 0; i < in.size(); i++) {
-            fusion(x, y, c) += in[i](x, y, c) * weight_maps[i](x, y) * normalize_weights(x, y);
+void TuningSession::update() {
+    for (size_t i = 0; i < stale.size(); i++) {
+        if (!stale[i]) {
+            continue;
         }
+        Buffer<float> frame = frames.sliced(3, i);
+        Buffer<float> measures = log_measures.sliced(3, i);
+        check_pipeline(measures_log_measures(raw(frame), raw(measures)), "measures_log_measures");
+        stale[i] = false;
     }
+}
 
-    apply_auto_schedule(fusion);
+Buffer<float> TuningSession::normalized_weights(float c_weight, float s_weight, float e_weight) {
+    update();
+
+    Buffer<float> weights(frames.width(), frames.height(), frames.dim(3).extent());
+    check_pipeline(measures_retune_weights(raw(log_measures), c_weight, s_weight, e_weight, raw(weights)),
+                   "measures_retune_weights");
+    return weights;
+}
+
+Buffer<float> TuningSession::fusion(float c_weight, float s_weight, float e_weight) {
+    update();
+
+    Buffer<float> fused(frames.width(), frames.height(), frames.channels());
+    check_pipeline(measures_retune(raw(frames), raw(log_measures), c_weight, s_weight, e_weight, raw(fused)),
+                   "measures_retune");
+    return fused;
+}
+
+Buffer<float> TuningSession::pyramid_fusion(float c_weight, float s_weight, float e_weight, int levels, Storage storage) {
+    std::vector<Buffer<float>> in;
+    for (int i = 0; i < frames.dim(3).extent(); i++) {
+        in.push_back(frames.sliced(3, i));
+    }
+    return compute_pyramid_fusion(in, normalized_weights(c_weight, s_weight, e_weight), levels, nullptr, storage);
+}
+
+FusionAccumulator::FusionAccumulator(
+  float c_weight,
+  float s_weight,
+  float e_weight,
+  Math math,
+  int levels,
+  Pyramid::LevelPool *pool
+) : c_weight(c_weight), s_weight(s_weight), e_weight(e_weight), math(math), pyramid(levels, pool) {}
+
+void FusionAccumulator::add_frame(const Buffer<float> &image) {
+    add_frame(image, compute(image, c_weight, s_weight, e_weight, DebugIntermediate::None, Schedule::Tiled, math));
+}
+
+void FusionAccumulator::add_frame(const Buffer<float> &image, const Buffer<float> &weight_map) {
+    pyramid.add(image, weight_map);
+}
 
-    return fusion.realize({in[0].width(), in[0].height(), in[0].channels()});
+Buffer<float> FusionAccumulator::finish() {
+    return pyramid.finish();
 }
 
-} // namespace Measures
\ No newline at end of file
+} // namespace Measures
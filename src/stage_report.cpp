@@ -0,0 +1,77 @@
+#include "stage_report.h"
+
+#include <algorithm>
+#include <mutex>
+#include <HalideRuntime.h>
+
+namespace Measures {
+
+static std::mutex profiler_lock;
+
+static StageReport &find_stage(Report &report, const std::string &name) {
+    for (StageReport &stage : report.stages) {
+        if (stage.name == name) {
+            return stage;
+        }
+    }
+    report.stages.push_back(StageReport());
+    report.stages.back().name = name;
+    return report.stages.back();
+}
+
+void add_stage(Report &report, const std::string &name, double time_ms, size_t peak_bytes, double threads) {
+    StageReport &stage = find_stage(report, name);
+
+    // Thread counts of repeated runs average by time.
+    double total_ms = stage.time_ms + time_ms;
+    if (total_ms > 0.0) {
+        stage.threads = (stage.threads * stage.time_ms + threads * time_ms) / total_ms;
+    }
+    stage.time_ms = total_ms;
+    stage.peak_bytes = std::max(stage.peak_bytes, peak_bytes);
+    report.peak_bytes = std::max(report.peak_bytes, peak_bytes);
+}
+
+int run_profiled(Report &report, const std::function<int()> &run) {
+    std::lock_guard<std::mutex> guard(profiler_lock);
+
+    halide_profiler_reset();
+    int error = run();
+    if (error != 0) {
+        return error;
+    }
+
+    // The profiler was reset and profiled runs are serialized, so all it
+    // sampled is this run.
+    halide_profiler_state *state = halide_profiler_get_state();
+    halide_mutex_lock(&state->lock);
+    for (halide_profiler_pipeline_stats *p = state->pipelines; p; p = (halide_profiler_pipeline_stats *) p->next) {
+        for (int i = 0; i < p->num_funcs; i++) {
+            const halide_profiler_func_stats &func = p->funcs[i];
+            if (func.time == 0 && func.memory_peak == 0) {
+                continue;
+            }
+            double threads = func.active_threads_denominator > 0 ?
+                (double) func.active_threads_numerator / func.active_threads_denominator : 0.0;
+            add_stage(report, func.name, func.time / 1e6, (size_t) func.memory_peak, threads);
+        }
+        report.peak_bytes = std::max(report.peak_bytes, (size_t) p->memory_peak);
+    }
+    halide_mutex_unlock(&state->lock);
+
+    // Nothing is left for the profiler to print at exit.
+    halide_profiler_reset();
+    return 0;
+}
+
+void finish_report(Report &report) {
+    report.time_ms = 0.0;
+    for (const StageReport &stage : report.stages) {
+        report.time_ms += stage.time_ms;
+    }
+    for (StageReport &stage : report.stages) {
+        stage.percentage = report.time_ms > 0.0 ? 100.0 * stage.time_ms / report.time_ms : 0.0;
+    }
+}
+
+} // namespace Measures
@@ -21,3 +21,13 @@ void apply_auto_schedule(Func F) {
     }
     cout << endl;
 }
+
+Func find_func(Func F, const string &name) {
+    map<string,Internal::Function> flist = Internal::find_transitive_calls(F.function());
+    map<string,Internal::Function>::iterator fit = flist.find(name);
+    if (fit == flist.end()) {
+        cerr << "Error: " << F.name() << " doesn't call " << name << endl;
+        exit(-1);
+    }
+    return Func(fit->second);
+}
@@ -0,0 +1,29 @@
+// The frame accumulator's memory stays the same from the first frame on,
+// and its result is close to the pyramid fusion.
+
+#include "quality_measures.h"
+#include "pyramid.h"
+#include "test_util.h"
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    const float psnr_bound = 30.f;
+    std::vector<Buffer<float>> in = Test::house_bracket<float>();
+
+    Pyramid::LevelPool pool;
+    Measures::FusionAccumulator accumulator(1.f, 1.f, 1.f, Measures::Math::Exact, 0, &pool);
+    std::vector<size_t> held;
+    for (const Buffer<float> &frame : in) {
+        accumulator.add_frame(frame);
+        held.push_back(pool.stats().bytes);
+    }
+    Buffer<float> accumulated = accumulator.finish();
+
+    std::cout << "Accumulated fusion: " << held.back() / (1024.f * 1024.f) << " MB of levels for "
+        << in.size() << " frames" << std::endl;
+    Test::check(held.front() == held.back(), "Accumulator memory grows with the number of frames");
+    Test::check_psnr("Accumulated fusion against the pyramid fusion", accumulated,
+                     Measures::compute_pyramid_fusion(in, Measures::compute_bracket(in)), psnr_bound);
+    return EXIT_SUCCESS;
+}
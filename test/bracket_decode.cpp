@@ -0,0 +1,18 @@
+// Decoding a bracket concurrently gives each file as decoded alone.
+
+#include "test_util.h"
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    std::vector<double> decode_ms;
+    std::vector<Buffer<float>> bracket = load_bracket<float>(Test::house, &decode_ms, 4);
+
+    Test::check(bracket.size() == Test::house.size() && decode_ms.size() == Test::house.size(),
+                "Concurrent decode returned the wrong number of exposures");
+    for (size_t i = 0; i < Test::house.size(); i++) {
+        std::cout << "Decoded " << Test::house[i] << " in " << decode_ms[i] << " ms" << std::endl;
+        Test::check_identical("Concurrent decode of " + Test::house[i], bracket[i], load<float>(Test::house[i]));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,19 @@
+// The fast-math weights against the exact path.
+
+#include "quality_measures.h"
+#include "test_util.h"
+
+int main(int argc, char** argv)
+{
+    const float max_error_bound = 1e-3f;
+    Buffer<float> image = load<float>("images/house-1.png");
+
+    for (const float *e : Test::exponents) {
+        Buffer<float> exact = Measures::compute(image, e[0], e[1], e[2]);
+        Buffer<float> fast = Measures::compute(image, e[0], e[1], e[2], Measures::DebugIntermediate::None,
+                                               Measures::Schedule::Tiled, Measures::Math::Fast);
+        Test::check_bound("Fast-math weights (" + std::to_string(e[0]) + ", " + std::to_string(e[1]) + ", " +
+                          std::to_string(e[2]) + ")", fast, exact, max_error_bound);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,21 @@
+// The multi-scale blend with float16 levels against full precision.
+
+#include "quality_measures.h"
+#include "test_util.h"
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    const float max_error_bound = 1e-2f;
+    std::vector<Buffer<float>> in = Test::house_bracket<float>();
+    Buffer<float> weight_maps = Measures::compute_bracket(in);
+
+    Measures::Report reports[2];
+    Buffer<float> full = Measures::compute_pyramid_fusion(in, weight_maps, 0, &reports[0]);
+    Buffer<float> half = Measures::compute_pyramid_fusion(in, weight_maps, 0, &reports[1], Measures::Storage::Float16);
+
+    std::cout << "Float16 pyramid levels: peak " << reports[1].peak_bytes / (1024.f * 1024.f)
+        << " MB (float " << reports[0].peak_bytes / (1024.f * 1024.f) << " MB)" << std::endl;
+    Test::check_bound("Float16 pyramid levels", half, full, max_error_bound);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+// JPEG decodes at 1/2, 1/4 and 1/8 scale have the size of the scaled image
+// and stay close to the full decode box-filtered to that size; a saved JPEG
+// loads back close to what was saved.
+
+#include "test_util.h"
+
+// The mean of im over factor x factor blocks, the last ones cut short by
+// the edges of im.
+Buffer<float> box_downsample(const Buffer<float> &im, int factor) {
+    int width = (im.width() + factor - 1) / factor, height = (im.height() + factor - 1) / factor;
+    Buffer<float> out(width, height, im.channels());
+    out.for_each_element([&](const int *pos) {
+        double sum = 0.0;
+        int count = 0;
+        for (int y = pos[1] * factor; y < std::min(im.height(), (pos[1] + 1) * factor); y++) {
+            for (int x = pos[0] * factor; x < std::min(im.width(), (pos[0] + 1) * factor); x++) {
+                sum += im(x, y, pos[2]);
+                count++;
+            }
+        }
+        out(pos) = (float) (sum / count);
+    });
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    const float scaled_psnr_bound = 40.f;
+    const float saved_psnr_bound = 40.f;
+    const std::string filename = "images/house-1.jpg";
+
+    Buffer<float> full = load_jpeg<float>(filename);
+    for (int scale_denom : {1, 2, 4, 8}) {
+        Buffer<float> scaled = load_jpeg<float>(filename, scale_denom);
+        std::string what = "JPEG decoded at 1/" + std::to_string(scale_denom);
+        Test::check(scaled.width() == (full.width() + scale_denom - 1) / scale_denom &&
+                    scaled.height() == (full.height() + scale_denom - 1) / scale_denom &&
+                    scaled.channels() == full.channels(),
+                    what + " has the wrong size");
+        Test::check_psnr(what + " against the box-filtered full decode", scaled,
+                         box_downsample(full, scale_denom), scaled_psnr_bound);
+    }
+
+    save_jpeg(full, "Output/test.jpg", 95);
+    Test::check_psnr("JPEG saved at quality 95", load<float>("Output/test.jpg"), full, saved_psnr_bound);
+    return EXIT_SUCCESS;
+}
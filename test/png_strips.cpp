@@ -0,0 +1,29 @@
+// The strip encoder's PNGs, at every filter and a few levels and strip
+// heights, decode to the same samples as libpng's.
+
+#include "test_util.h"
+
+int main(int argc, char** argv)
+{
+    const PngFilter filters[] = {PngFilter::Adaptive, PngFilter::None, PngFilter::Sub,
+                                 PngFilter::Up, PngFilter::Average, PngFilter::Paeth};
+
+    Buffer<uint16_t> image = load<uint16_t>("images/house-1.png");
+    save(image, "Output/test-png-libpng.png");
+    Buffer<uint16_t> expected = load<uint16_t>("Output/test-png-libpng.png");
+
+    for (PngFilter filter : filters) {
+        for (int strip_rows : {0, 1, 16}) {
+            PngOptions options;
+            options.filter = filter;
+            options.level = strip_rows == 1 ? 1 : -1;
+            options.threads = 0;
+            options.strip_rows = strip_rows;
+            save(image, "Output/test-png-strips.png", options);
+            Test::check_identical("Strip-encoded PNG (filter " + std::to_string((int) filter) + ", " +
+                                  std::to_string(strip_rows) + " rows per strip)",
+                                  load<uint16_t>("Output/test-png-strips.png"), expected);
+        }
+    }
+    return EXIT_SUCCESS;
+}
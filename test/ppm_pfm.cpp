@@ -0,0 +1,52 @@
+// PPM and PFM files, written and read through memory mappings, load back
+// exactly as saved: 8 and 16-bit PPM samples, including rows the header
+// leaves unaligned, and PFM floats of one or three channels, bit for bit.
+
+#include "test_util.h"
+#include <limits>
+#include <random>
+
+template<typename T>
+void check_round_trip(const std::string &what, const Buffer<T> &im, const std::string &filename) {
+    save(im, filename);
+    Test::check_identical(what, load<T>(filename), im);
+}
+
+int main(int argc, char** argv)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> sample(0, 65535);
+    std::uniform_real_distribution<float> value(-1.f, 2.f);
+    const float special[] = {
+        std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(), -0.f, 1e30f, std::numeric_limits<float>::denorm_min()
+    };
+
+    // "P6\n37 11\n65535\n" is 15 bytes, so the 16-bit samples of the first
+    // size are unaligned in the mapping; those of the second aren't.
+    const int sizes[2][2] = {{37, 11}, {100, 20}};
+    for (const auto &size : sizes) {
+        std::string shape = std::to_string(size[0]) + "x" + std::to_string(size[1]);
+
+        Buffer<uint8_t> im8(size[0], size[1], 3);
+        Buffer<uint16_t> im16(size[0], size[1], 3);
+        im16.for_each_element([&](const int *pos) {
+            im16(pos) = (uint16_t) sample(rng);
+            im8(pos) = (uint8_t) im16(pos);
+        });
+        check_round_trip("8-bit PPM " + shape, im8, "Output/test-8.ppm");
+        check_round_trip("16-bit PPM " + shape, im16, "Output/test-16.ppm");
+
+        for (int channels : {1, 3}) {
+            Buffer<float> im = channels == 3 ? Buffer<float>(size[0], size[1], 3) : Buffer<float>(size[0], size[1]);
+            // Every seventh sample is one of the special values.
+            size_t i = 0;
+            im.for_each_element([&](const int *pos) {
+                im(pos) = i % 7 ? value(rng) : special[i / 7 % (sizeof(special) / sizeof(special[0]))];
+                i++;
+            });
+            check_round_trip(std::to_string(channels) + "-channel PFM " + shape, im, "Output/test.pfm");
+        }
+    }
+    return EXIT_SUCCESS;
+}
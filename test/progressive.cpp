@@ -0,0 +1,46 @@
+// The progressive fusion refines a coarse preview to full resolution, from
+// where it stopped. The result is close to the pyramid fusion, and the
+// preview to the same box-filtered level of the result.
+
+#include "quality_measures.h"
+#include "progressive_fusion.h"
+#include "pyramid.h"
+#include "test_util.h"
+#include <stdexcept>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    const float fusion_psnr_bound = 25.f;
+    const float preview_psnr_bound = 20.f;
+    std::vector<Buffer<float>> in = Test::house_bracket<float>();
+
+    bool rejected = false;
+    try {
+        Measures::ProgressiveFusion empty({});
+    } catch (const std::invalid_argument &) {
+        rejected = true;
+    }
+    Test::check(rejected, "Progressive fusion of an empty bracket didn't throw");
+
+    Measures::ProgressiveFusion progressive(in);
+    Buffer<float> preview = progressive.refine(20.0);
+    int preview_level = progressive.level();
+    Test::check(preview.width() <= in[0].width() && preview.height() <= in[0].height(),
+                "Progressive preview is larger than the bracket");
+
+    Buffer<float> refined = progressive.refine();
+    Test::check(progressive.finished() && refined.width() == in[0].width() && refined.height() == in[0].height(),
+                "Progressive fusion didn't refine to full resolution");
+
+    std::cout << "Progressive fusion: " << preview.width() << "x" << preview.height()
+        << " preview at level " << preview_level << std::endl;
+    Test::check_psnr("Progressive fusion against the pyramid fusion", refined,
+                     Measures::compute_pyramid_fusion(in, Measures::compute_bracket(in)), fusion_psnr_bound);
+
+    // The preview levels are box-filtered, so the result is reduced the same way.
+    Buffer<> reduced = Buffer<float>(preview.width(), preview.height(), preview.channels());
+    Pyramid::reduce_level(refined, reduced, 1 << preview_level);
+    Test::check_psnr("Progressive preview against the reduced result", preview, reduced.as<float>(), preview_psnr_bound);
+    return EXIT_SUCCESS;
+}
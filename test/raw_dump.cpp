@@ -0,0 +1,25 @@
+// Raw dumps keep the intermediates exactly, negative laplacians included.
+
+#include "quality_measures.h"
+#include "test_util.h"
+
+int main(int argc, char** argv)
+{
+    Buffer<float> image = load<float>("images/house-1.png");
+    Buffer<float> laplacian = Measures::compute_intermediates(image, {
+        Measures::DebugIntermediate::Laplacian
+    })[Measures::DebugIntermediate::Laplacian];
+
+    save(laplacian, "Output/test-laplacian.raw");
+    Test::check_identical("Raw dump of the laplacian", load<float>("Output/test-laplacian.raw"), laplacian);
+
+    // A copy of the MappedRaw keeps the mapping alive after the original goes.
+    MappedRaw<float> kept;
+    {
+        MappedRaw<float> mapped = map_raw<float>("Output/test-laplacian.raw");
+        Test::check(mapped.file != nullptr, "A dense float dump should be mapped, not copied");
+        kept = mapped;
+    }
+    Test::check_identical("Mapped raw dump of the laplacian", kept.buffer, laplacian);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,18 @@
+// Fusing in strips is bit-identical to the whole-image path.
+
+#include "quality_measures.h"
+#include "test_util.h"
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    std::vector<Buffer<float>> in = Test::house_bracket<float>();
+
+    std::vector<Buffer<float>> frame_weights;
+    for (const Buffer<float> &frame : in) {
+        frame_weights.push_back(Measures::compute(frame));
+    }
+    Buffer<float> whole = Measures::compute_fusion(in, frame_weights);
+    Test::check_identical("Streamed fusion", Measures::compute_fusion_streaming(in, 64), whole);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+// Checks shared by the tests in this directory. Each test is one program
+// that prints what it measures and exits with EXIT_FAILURE at the first
+// check that fails; `make test` builds and runs them all from the root of
+// the repository, where images/ and Output/ are.
+
+#pragma once
+
+#include <image_io.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Test {
+
+  // Exponents (contrast, saturation, exposure) the weight tests sweep: the
+  // defaults, one measure alone, and uneven ones.
+  const float exponents[3][3] = {{1.f, 1.f, 1.f}, {1.f, 0.f, 0.f}, {0.5f, 2.f, 1.5f}};
+
+  // The bracket most tests fuse, four exposures of the same scene.
+  const std::vector<std::string> house = {"images/house-1.png", "images/house-2.png",
+                                          "images/house-3.png", "images/house-4.png"};
+
+  template<typename T>
+  std::vector<Buffer<T>> house_bracket() {
+      return load_bracket<T>(house);
+  }
+
+  inline void fail(const std::string &message) {
+      std::cerr << message << std::endl;
+      exit(EXIT_FAILURE);
+  }
+
+  inline void check(bool condition, const std::string &message) {
+      if (!condition) {
+          fail(message);
+      }
+  }
+
+  template<typename T>
+  bool same_shape(const Buffer<T> &a, const Buffer<T> &b) {
+      if (a.dimensions() != b.dimensions()) {
+          return false;
+      }
+      for (int d = 0; d < a.dimensions(); d++) {
+          if (a.dim(d).min() != b.dim(d).min() || a.dim(d).extent() != b.dim(d).extent()) {
+              return false;
+          }
+      }
+      return true;
+  }
+
+  // The largest absolute difference between result and reference, which
+  // must have the same shape. Samples where reference isn't finite, e.g. the
+  // undefined normalization of weights that are all zero, are skipped.
+  inline float max_error(const Buffer<float> &result, const Buffer<float> &reference) {
+      check(same_shape(result, reference), "Result and reference differ in shape");
+      float error = 0.f;
+      reference.for_each_element([&](const int *pos) {
+          if (std::isfinite(reference(pos))) {
+              error = std::max(error, std::abs(result(pos) - reference(pos)));
+          }
+      });
+      return error;
+  }
+
+  // Prints the max error of what and fails if it exceeds bound (or is NaN).
+  inline void check_bound(const std::string &what, float error, float bound) {
+      std::cout << what << ": max error " << error << std::endl;
+      if (!(error <= bound)) {
+          fail(what + " exceeds the error bound of " + std::to_string(bound));
+      }
+  }
+
+  inline void check_bound(const std::string &what, const Buffer<float> &result,
+                          const Buffer<float> &reference, float bound) {
+      check_bound(what, max_error(result, reference), bound);
+  }
+
+  // The PSNR in dB of result against reference, for samples in [0, 1];
+  // infinite if they are equal. Skips the samples max_error skips.
+  inline float psnr(const Buffer<float> &result, const Buffer<float> &reference) {
+      check(same_shape(result, reference), "Result and reference differ in shape");
+      double squares = 0.0;
+      size_t samples = 0;
+      reference.for_each_element([&](const int *pos) {
+          if (std::isfinite(reference(pos))) {
+              double difference = result(pos) - reference(pos);
+              squares += difference * difference;
+              samples++;
+          }
+      });
+      double rms = std::sqrt(squares / std::max<size_t>(1, samples));
+      return rms > 0.0 ? (float) (-20.0 * std::log10(rms)) : INFINITY;
+  }
+
+  // Prints the PSNR of what and fails if it is below bound dB (or NaN).
+  inline void check_psnr(const std::string &what, const Buffer<float> &result,
+                         const Buffer<float> &reference, float bound) {
+      float db = psnr(result, reference);
+      std::cout << what << ": PSNR " << db << " dB" << std::endl;
+      if (!(db >= bound)) {
+          fail(what + " is below the PSNR bound of " + std::to_string(bound) + " dB");
+      }
+  }
+
+  // Fails unless a and b have the same shape and the same bits in every
+  // sample, so that -0 and 0 or two NaNs of different payloads differ.
+  template<typename T>
+  void check_identical(const std::string &what, const Buffer<T> &a, const Buffer<T> &b) {
+      check(same_shape(a, b), what + ": shapes differ");
+      a.for_each_element([&](const int *pos) {
+          if (memcmp(&a(pos), &b(pos), sizeof(T)) != 0) {
+              std::string at;
+              for (int d = 0; d < a.dimensions(); d++) {
+                  at += (d ? ", " : "") + std::to_string(pos[d]);
+              }
+              fail(what + ": differs at (" + at + ")");
+          }
+      });
+      std::cout << what << ": identical" << std::endl;
+  }
+
+} // namespace Test
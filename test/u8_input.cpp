@@ -0,0 +1,24 @@
+// The 8-bit input path, which normalizes inside the pipelines, against the
+// float path on the same samples.
+
+#include "quality_measures.h"
+#include "test_util.h"
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    const float max_error_bound = 1e-4f;
+    std::vector<Buffer<float>> in = Test::house_bracket<float>();
+    std::vector<Buffer<uint8_t>> in_u8 = Test::house_bracket<uint8_t>();
+
+    std::vector<Buffer<float>> weights_u8;
+    for (size_t i = 0; i < in_u8.size(); i++) {
+        weights_u8.push_back(Measures::compute(in_u8[i]));
+        Test::check_bound("8-bit weights of " + Test::house[i], weights_u8[i], Measures::compute(in[i]), max_error_bound);
+    }
+
+    Buffer<float> weight_maps = Measures::compute_bracket(in);
+    Test::check_bound("8-bit fusion", Measures::compute_fusion(in_u8, weight_maps),
+                      Measures::compute_fusion(in, weight_maps), max_error_bound);
+    return EXIT_SUCCESS;
+}
@@ -10,7 +10,7 @@
 #include <cmath>
 #include <Halide.h>
 #include <image_io.h>
-#include <timing.h>
+#include <jit_timing.h>
 
 using std::cout;
 using std::endl;